@@ -0,0 +1,140 @@
+#define _XOPEN_SOURCE 700
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "color.h"
+#include "gamma.h"
+#include "stats.h"
+
+/*
+ * Times the pure hot paths, without a display. Results are printed one per
+ * line in the same "name{labels} value" format as the runtime statistics:
+ * nanoseconds per operation and operations or bytes per second.
+ */
+
+static const uint32_t ramp_sizes[] = { 256, 1024, 4096, 65536 };
+static const double gammas[] = { 0.7, 1.0, 2.2 };
+
+// Keeps results alive so the loops are not optimized away
+static volatile double sink;
+
+static void report(const char *name, const char *labels, uint64_t ops,
+		uint64_t bytes, int64_t ns) {
+	printf("bench_ns_per_op{bench=\"%s\"%s} %.1f\n", name, labels, (double)ns / ops);
+	printf("bench_ops_per_sec{bench=\"%s\"%s} %.0f\n", name, labels, ops * 1e9 / ns);
+	if (bytes > 0) {
+		printf("bench_bytes_per_sec{bench=\"%s\"%s} %.0f\n", name, labels, bytes * 1e9 / ns);
+	}
+}
+
+// Every 5 degrees of latitude for every day of a leap year
+static void bench_calc_sun(void) {
+	const int rounds = 20;
+	uint64_t ops = 0;
+	double acc = 0.0;
+	int64_t start = stats_clock();
+	for (int round = 0; round < rounds; round++) {
+		for (int lat = -90; lat <= 90; lat += 5) {
+			for (int day = 0; day < 366; day++) {
+				struct tm tm = { .tm_year = 124, .tm_yday = day };
+				struct sun sun;
+				enum sun_condition cond = calc_sun(&tm, RADIANS(lat),
+					RADIANS(90.833 + 6.0), RADIANS(90.833 - 3.0), &sun);
+				acc += cond + sun.dawn + sun.sunset;
+				ops++;
+			}
+		}
+	}
+	report("calc_sun", "", ops, 0, stats_clock() - start);
+	sink = acc;
+}
+
+static void bench_calc_whitepoint(void) {
+	const int rounds = 20;
+	uint64_t ops = 0;
+	double acc = 0.0;
+	int64_t start = stats_clock();
+	for (int round = 0; round < rounds; round++) {
+		for (int temp = 1000; temp <= 25000; temp += 10) {
+			struct rgb wp = calc_whitepoint(temp);
+			acc += wp.r + wp.g + wp.b;
+			ops++;
+		}
+	}
+	report("calc_whitepoint", "", ops, 0, stats_clock() - start);
+	sink = acc;
+}
+
+// The table used at runtime, over the same range as calc_whitepoint()
+static void bench_lookup_whitepoint(void) {
+	const int rounds = 20;
+	uint64_t ops = 0;
+	double acc = 0.0;
+	int64_t start = stats_clock();
+	for (int round = 0; round < rounds; round++) {
+		for (int temp = 1000; temp <= 25000; temp += 10) {
+			struct rgb wp = lookup_whitepoint(temp);
+			acc += wp.r + wp.g + wp.b;
+			ops++;
+		}
+	}
+	report("lookup_whitepoint", "", ops, 0, stats_clock() - start);
+	sink = acc;
+}
+
+#define FILL_WHITEPOINTS 9000
+
+// Computed up front so that only the table work is timed
+static struct rgb fill_whitepoints[FILL_WHITEPOINTS];
+
+// A new whitepoint every time, so that each get fills and hashes a table
+static int bench_table_fill(uint32_t ramp_size, double gamma) {
+	struct gamma_curve *curve = gamma_curve_get(ramp_size, gamma);
+	if (curve == NULL) {
+		return -1;
+	}
+	uint64_t ops = (1 << 24) / ramp_size;
+	uint64_t bytes = 0;
+	double acc = 0.0;
+	int64_t start = stats_clock();
+	for (uint64_t op = 0; op < ops; op++) {
+		struct gamma_table *table = gamma_table_get(curve,
+			&fill_whitepoints[op % FILL_WHITEPOINTS]);
+		if (table == NULL) {
+			gamma_curve_put(curve);
+			return -1;
+		}
+		acc += table->data[ramp_size - 1];
+		bytes += table->size;
+		gamma_table_put(table);
+	}
+	int64_t ns = stats_clock() - start;
+	gamma_curve_put(curve);
+
+	char labels[64];
+	snprintf(labels, sizeof labels, ",ramp_size=\"%u\",gamma=\"%.1f\"", ramp_size, gamma);
+	report("table_fill", labels, ops, bytes, ns);
+	sink = acc;
+	return 0;
+}
+
+int main(void) {
+	bench_calc_sun();
+	bench_calc_whitepoint();
+	bench_lookup_whitepoint();
+	for (int idx = 0; idx < FILL_WHITEPOINTS; idx++) {
+		fill_whitepoints[idx] = calc_whitepoint(1000 + idx);
+	}
+	for (size_t size_idx = 0; size_idx < sizeof ramp_sizes / sizeof ramp_sizes[0]; size_idx++) {
+		for (size_t gamma_idx = 0; gamma_idx < sizeof gammas / sizeof gammas[0]; gamma_idx++) {
+			if (bench_table_fill(ramp_sizes[size_idx], gammas[gamma_idx]) == -1) {
+				fprintf(stderr, "could not create gamma table\n");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	return EXIT_SUCCESS;
+}
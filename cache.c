@@ -0,0 +1,42 @@
+#define _POSIX_C_SOURCE 200809L
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= FNV1A_PRIME;
+	}
+	return hash;
+}
+
+int get_cache_path(char *path, size_t len, const char *name, uint64_t hash) {
+	char dir[PATH_MAX];
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int res;
+	if (cache_home != NULL && cache_home[0] != '\0') {
+		res = snprintf(dir, sizeof dir, "%s", cache_home);
+	} else if (home != NULL && home[0] != '\0') {
+		res = snprintf(dir, sizeof dir, "%s/.cache", home);
+	} else {
+		return -1;
+	}
+	if (res < 0 || (size_t)res >= sizeof dir) {
+		return -1;
+	}
+
+	// Failures show up when the file is opened
+	mkdir(dir, 0700);
+	strncat(dir, "/wlsunset", sizeof dir - strlen(dir) - 1);
+	mkdir(dir, 0700);
+
+	res = snprintf(path, len, "%s/%s-%016llx", dir, name, (unsigned long long)hash);
+	return res < 0 || (size_t)res >= len ? -1 : 0;
+}
@@ -0,0 +1,19 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Helpers shared by the files kept in $XDG_CACHE_HOME/wlsunset, and the
+ * FNV-1a hash used to key and check them.
+ */
+#define FNV1A_INIT 0xcbf29ce484222325ULL
+#define FNV1A_PRIME 0x100000001b3ULL
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t len);
+
+// Creates the directory if needed and formats <dir>/<name>-<hash> into path
+int get_cache_path(char *path, size_t len, const char *name, uint64_t hash);
+
+#endif
@@ -169,6 +169,22 @@ static struct rgb xyz_to_rgb(const struct xyz *xyz) {
 	};
 }
 
+static struct xyz rgb_to_xyz(const struct rgb *rgb) {
+	// Inverse of xyz_to_rgb(), without the clamping
+	double r = pow(rgb->r, 2.2), g = pow(rgb->g, 2.2), b = pow(rgb->b, 2.2);
+	return (struct xyz) {
+		.x = 0.4124564 * r + 0.3575761 * g + 0.1804375 * b,
+		.y = 0.2126729 * r + 0.7151522 * g + 0.0721750 * b,
+		.z = 0.0193339 * r + 0.1191920 * g + 0.9503041 * b
+	};
+}
+
+struct chromaticity whitepoint_chromaticity(const struct rgb *wp) {
+	struct xyz xyz = rgb_to_xyz(wp);
+	double d = xyz.x + 15 * xyz.y + 3 * xyz.z;
+	return (struct chromaticity) {.u = 4 * xyz.x / d, .v = 9 * xyz.y / d};
+}
+
 static void rgb_normalize(struct rgb *rgb) {
 	double maxw = fmax(rgb->r, fmax(rgb->g, rgb->b));
 	rgb->r /= maxw;
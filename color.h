@@ -34,4 +34,14 @@ enum sun_condition calc_sun(struct tm *tm, double latitude,
 	double elevation_twilight, double elevation_daylight, struct sun *sun);
 struct rgb calc_whitepoint(int temp);
 
+// Tabulated calc_whitepoint(), accurate to within WHITEPOINT_MAX_ERROR.
+struct rgb lookup_whitepoint(int temp);
+
+// CIE 1976 u'v' chromaticity, which is roughly perceptually uniform
+struct chromaticity {
+	double u, v;
+};
+
+struct chromaticity whitepoint_chromaticity(const struct rgb *wp);
+
 #endif
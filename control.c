@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "control.h"
+
+#define CONTROL_LINE_MAX 512
+
+struct control_client {
+	struct control_client *next;
+	struct control *control;
+	struct event_source source;
+
+	char buf[CONTROL_LINE_MAX];
+	size_t len;
+};
+
+static void client_destroy(struct control_client *client) {
+	struct control *control = client->control;
+	for (struct control_client **link = &control->clients; *link != NULL;
+			link = &(*link)->next) {
+		if (*link == client) {
+			*link = client->next;
+			break;
+		}
+	}
+	event_loop_remove(control->loop, &client->source);
+	close(client->source.fd);
+	free(client);
+}
+
+static int client_send(struct control_client *client, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t res = send(client->source.fd, data, len, MSG_NOSIGNAL);
+		if (res == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// Replies are small, a client that does not read them is gone
+			return -1;
+		}
+		data += res;
+		len -= res;
+	}
+	return 0;
+}
+
+static int client_process(struct control_client *client) {
+	struct control *control = client->control;
+	char *reply_buf = NULL;
+	size_t reply_len = 0;
+	FILE *reply = open_memstream(&reply_buf, &reply_len);
+	if (reply == NULL) {
+		return -1;
+	}
+
+	char *line = client->buf;
+	char *end;
+	while ((end = memchr(line, '\n', client->len - (line - client->buf))) != NULL) {
+		*end = '\0';
+		if (end > line && end[-1] == '\r') {
+			end[-1] = '\0';
+		}
+		if (line[0] != '\0') {
+			control->handler(control->data, line, reply);
+		}
+		line = end + 1;
+	}
+
+	client->len -= line - client->buf;
+	memmove(client->buf, line, client->len);
+	bool overflow = client->len == sizeof client->buf;
+	if (overflow) {
+		fprintf(reply, "error line too long\n");
+	}
+
+	int ret = fclose(reply) == 0 ? 0 : -1;
+	if (ret == 0 && reply_len > 0) {
+		ret = client_send(client, reply_buf, reply_len);
+	}
+	free(reply_buf);
+	return overflow ? -1 : ret;
+}
+
+static int handle_client(void *data, uint32_t events) {
+	struct control_client *client = data;
+	if (events & EPOLLIN) {
+		ssize_t res = read(client->source.fd, client->buf + client->len,
+			sizeof client->buf - client->len);
+		if (res > 0) {
+			client->len += res;
+			if (client_process(client) == -1) {
+				client_destroy(client);
+			}
+			return 0;
+		} else if (res == -1 && (errno == EAGAIN || errno == EINTR)) {
+			return 0;
+		}
+	}
+	client_destroy(client);
+	return 0;
+}
+
+static int handle_listen(void *data, uint32_t events) {
+	(void)events;
+	struct control *control = data;
+	int fd = accept4(control->source.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd == -1) {
+		return 0;
+	}
+
+	struct control_client *client = calloc(1, sizeof(struct control_client));
+	if (client == NULL) {
+		close(fd);
+		return 0;
+	}
+	client->control = control;
+	client->source = (struct event_source) {
+		.fd = fd,
+		.events = EPOLLIN,
+		.handler = handle_client,
+		.data = client,
+	};
+	if (event_loop_add(control->loop, &client->source) == -1) {
+		close(fd);
+		free(client);
+		return 0;
+	}
+	client->next = control->clients;
+	control->clients = client;
+	return 0;
+}
+
+int control_init(struct control *control, struct event_loop *loop,
+		const char *path, control_handler handler, void *data) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof addr.sun_path) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	// A socket left behind by an earlier instance would make bind fail
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof addr) == -1 ||
+			listen(fd, 4) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	*control = (struct control) {
+		.loop = loop,
+		.source = {
+			.fd = fd,
+			.events = EPOLLIN,
+			.handler = handle_listen,
+			.data = control,
+		},
+		.path = strdup(path),
+		.handler = handler,
+		.data = data,
+	};
+	if (control->path == NULL || event_loop_add(loop, &control->source) == -1) {
+		free(control->path);
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	return 0;
+}
+
+void control_finish(struct control *control) {
+	while (control->clients != NULL) {
+		client_destroy(control->clients);
+	}
+	event_loop_remove(control->loop, &control->source);
+	close(control->source.fd);
+	unlink(control->path);
+	free(control->path);
+}
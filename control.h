@@ -0,0 +1,32 @@
+#ifndef _CONTROL_H
+#define _CONTROL_H
+
+#include <stdio.h>
+
+#include "event_loop.h"
+
+/*
+ * A line based control socket. Every complete line received from a client
+ * is passed to the handler, which writes its reply to the given stream. The
+ * replies to all lines read at once are sent back together, so a client can
+ * batch commands in a single write.
+ */
+typedef void (*control_handler)(void *data, char *line, FILE *reply);
+
+struct control_client;
+
+struct control {
+	struct event_loop *loop;
+	struct event_source source;
+	struct control_client *clients;
+	char *path;
+
+	control_handler handler;
+	void *data;
+};
+
+int control_init(struct control *control, struct event_loop *loop,
+		const char *path, control_handler handler, void *data);
+void control_finish(struct control *control);
+
+#endif
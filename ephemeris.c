@@ -0,0 +1,180 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "ephemeris.h"
+
+static bool is_leap(int year) {
+	return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+static uint64_t params_hash(const struct ephemeris_header *header) {
+	uint64_t hash = FNV1A_INIT;
+	hash = fnv1a(hash, &header->version, sizeof header->version);
+	hash = fnv1a(hash, &header->latitude, sizeof header->latitude);
+	hash = fnv1a(hash, &header->elevation_twilight, sizeof header->elevation_twilight);
+	hash = fnv1a(hash, &header->elevation_daylight, sizeof header->elevation_daylight);
+	return hash;
+}
+
+static void init_header(struct ephemeris_header *header, double latitude,
+		double elevation_twilight, double elevation_daylight) {
+	*header = (struct ephemeris_header) {
+		.version = EPHEMERIS_VERSION,
+		.days = EPHEMERIS_DAYS,
+		.latitude = latitude,
+		.elevation_twilight = elevation_twilight,
+		.elevation_daylight = elevation_daylight,
+	};
+	memcpy(header->magic, EPHEMERIS_MAGIC, sizeof header->magic);
+	header->hash = params_hash(header);
+}
+
+static bool header_matches(const struct ephemeris_header *a,
+		const struct ephemeris_header *b) {
+	return memcmp(a->magic, b->magic, sizeof a->magic) == 0 &&
+		a->version == b->version && a->days == b->days &&
+		a->hash == b->hash && a->latitude == b->latitude &&
+		a->elevation_twilight == b->elevation_twilight &&
+		a->elevation_daylight == b->elevation_daylight;
+}
+
+static void compute_days(struct ephemeris_day *days, const struct ephemeris_header *header) {
+	for (int idx = 0; idx < EPHEMERIS_DAYS; idx++) {
+		// Any common and any leap year will do
+		struct tm tm = {
+			.tm_year = idx < 365 ? 101 : 100,
+			.tm_yday = idx < 365 ? idx : idx - 365,
+		};
+		struct sun sun;
+		enum sun_condition cond = calc_sun(&tm, header->latitude,
+			header->elevation_twilight, header->elevation_daylight, &sun);
+		days[idx] = (struct ephemeris_day) { .condition = cond };
+		if (cond == NORMAL) {
+			days[idx].dawn = sun.dawn;
+			days[idx].sunrise = sun.sunrise;
+			days[idx].sunset = sun.sunset;
+			days[idx].night = sun.night;
+		}
+	}
+}
+
+static int map_cache(struct ephemeris *eph, const char *path,
+		const struct ephemeris_header *expected) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return -1;
+	}
+	size_t size = sizeof(struct ephemeris_header) +
+		EPHEMERIS_DAYS * sizeof(struct ephemeris_day);
+	struct stat st;
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size != size) {
+		close(fd);
+		return -1;
+	}
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return -1;
+	}
+	if (!header_matches(data, expected)) {
+		munmap(data, size);
+		return -1;
+	}
+
+	eph->header = data;
+	eph->days = (struct ephemeris_day *)(eph->header + 1);
+	eph->size = size;
+	eph->mapped = true;
+	return 0;
+}
+
+static void write_cache(const struct ephemeris *eph, const char *path) {
+	char tmp_path[PATH_MAX];
+	int res = snprintf(tmp_path, sizeof tmp_path, "%s.XXXXXX", path);
+	if (res < 0 || (size_t)res >= sizeof tmp_path) {
+		return;
+	}
+	int fd = mkstemp(tmp_path);
+	if (fd == -1) {
+		return;
+	}
+
+	const char *data = (const char *)eph->header;
+	size_t len = eph->size;
+	while (len > 0) {
+		ssize_t written = write(fd, data, len);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		data += written;
+		len -= written;
+	}
+	// Concurrent instances race to the same content, the last rename wins
+	if (close(fd) == -1 || len > 0 || rename(tmp_path, path) == -1) {
+		unlink(tmp_path);
+	}
+}
+
+int ephemeris_load(struct ephemeris *eph, double latitude,
+		double elevation_twilight, double elevation_daylight) {
+	struct ephemeris_header expected;
+	init_header(&expected, latitude, elevation_twilight, elevation_daylight);
+
+	char path[PATH_MAX];
+	bool has_path = get_cache_path(path, sizeof path, "ephemeris", expected.hash) == 0;
+	if (has_path && map_cache(eph, path, &expected) == 0) {
+		return 0;
+	}
+
+	eph->size = sizeof(struct ephemeris_header) +
+		EPHEMERIS_DAYS * sizeof(struct ephemeris_day);
+	eph->header = malloc(eph->size);
+	if (eph->header == NULL) {
+		return -1;
+	}
+	*eph->header = expected;
+	eph->days = (struct ephemeris_day *)(eph->header + 1);
+	eph->mapped = false;
+	compute_days(eph->days, eph->header);
+
+	if (has_path) {
+		write_cache(eph, path);
+	}
+	return 0;
+}
+
+void ephemeris_finish(struct ephemeris *eph) {
+	if (eph->header == NULL) {
+		return;
+	}
+	if (eph->mapped) {
+		munmap(eph->header, eph->size);
+	} else {
+		free(eph->header);
+	}
+	eph->header = NULL;
+	eph->days = NULL;
+}
+
+enum sun_condition ephemeris_get(const struct ephemeris *eph,
+		const struct tm *tm, struct sun *sun) {
+	int idx = tm->tm_yday + (is_leap(tm->tm_year + 1900) ? 365 : 0);
+	const struct ephemeris_day *day = &eph->days[idx];
+	sun->dawn = day->dawn;
+	sun->sunrise = day->sunrise;
+	sun->sunset = day->sunset;
+	sun->night = day->night;
+	return day->condition;
+}
@@ -0,0 +1,57 @@
+#ifndef _EPHEMERIS_H
+#define _EPHEMERIS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "color.h"
+
+/*
+ * calc_sun() only depends on the day of the year and whether the year is a
+ * leap year, so a year's worth of results for a given latitude and elevation
+ * pair covers every day. The results are kept in a cache file so that they
+ * only have to be computed once.
+ *
+ * The file is a header followed by 365 days for common years and then 366
+ * days for leap years, in native byte order.
+ */
+#define EPHEMERIS_MAGIC "wlsuneph"
+#define EPHEMERIS_VERSION 1
+#define EPHEMERIS_DAYS (365 + 366)
+
+struct ephemeris_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t days;
+	uint64_t hash;
+	double latitude;
+	double elevation_twilight;
+	double elevation_daylight;
+};
+
+// Seconds from UTC midnight, as returned by calc_sun()
+struct ephemeris_day {
+	int32_t dawn;
+	int32_t sunrise;
+	int32_t sunset;
+	int32_t night;
+	int32_t condition;
+};
+
+struct ephemeris {
+	struct ephemeris_header *header;
+	struct ephemeris_day *days;
+	size_t size;
+	bool mapped;
+};
+
+int ephemeris_load(struct ephemeris *eph, double latitude,
+		double elevation_twilight, double elevation_daylight);
+void ephemeris_finish(struct ephemeris *eph);
+
+enum sun_condition ephemeris_get(const struct ephemeris *eph,
+		const struct tm *tm, struct sun *sun);
+
+#endif
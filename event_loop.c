@@ -0,0 +1,60 @@
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "event_loop.h"
+
+#define MAX_EVENTS 8
+
+int event_loop_init(struct event_loop *loop) {
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	return loop->epoll_fd == -1 ? -1 : 0;
+}
+
+void event_loop_finish(struct event_loop *loop) {
+	if (loop->epoll_fd != -1) {
+		close(loop->epoll_fd);
+		loop->epoll_fd = -1;
+	}
+}
+
+int event_loop_add(struct event_loop *loop, struct event_source *source) {
+	struct epoll_event ev = {
+		.events = source->events,
+		.data.ptr = source,
+	};
+	return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd, &ev);
+}
+
+int event_loop_update(struct event_loop *loop, struct event_source *source,
+		uint32_t events) {
+	struct epoll_event ev = {
+		.events = events,
+		.data.ptr = source,
+	};
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &ev) == -1) {
+		return -1;
+	}
+	source->events = events;
+	return 0;
+}
+
+int event_loop_remove(struct event_loop *loop, struct event_source *source) {
+	return epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+}
+
+int event_loop_dispatch(struct event_loop *loop, int timeout) {
+	struct epoll_event events[MAX_EVENTS];
+	int count = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout);
+	if (count == -1) {
+		return errno == EINTR ? 0 : -1;
+	}
+
+	for (int idx = 0; idx < count; idx++) {
+		struct event_source *source = events[idx].data.ptr;
+		if (source->handler(source->data, events[idx].events) == -1) {
+			return -1;
+		}
+	}
+	return count;
+}
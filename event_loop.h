@@ -0,0 +1,32 @@
+#ifndef _EVENT_LOOP_H
+#define _EVENT_LOOP_H
+
+#include <stdint.h>
+
+/*
+ * A minimal epoll-based event loop. Sources are owned by the caller and
+ * registered with the loop, which calls their handler with the received
+ * epoll events. A handler returning -1 aborts the dispatch.
+ */
+struct event_source {
+	int fd;
+	uint32_t events;
+	int (*handler)(void *data, uint32_t events);
+	void *data;
+};
+
+struct event_loop {
+	int epoll_fd;
+};
+
+int event_loop_init(struct event_loop *loop);
+void event_loop_finish(struct event_loop *loop);
+
+int event_loop_add(struct event_loop *loop, struct event_source *source);
+int event_loop_update(struct event_loop *loop, struct event_source *source,
+		uint32_t events);
+int event_loop_remove(struct event_loop *loop, struct event_source *source);
+
+int event_loop_dispatch(struct event_loop *loop, int timeout);
+
+#endif
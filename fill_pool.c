@@ -0,0 +1,97 @@
+#include <stdlib.h>
+
+#include "fill_pool.h"
+
+// Called with the mutex held, returns with it held
+static void run_jobs(struct fill_pool *pool) {
+	while (pool->next < pool->count) {
+		struct gamma_table *table = pool->tables[pool->next++];
+		pthread_mutex_unlock(&pool->mutex);
+		gamma_table_fill(table);
+		pthread_mutex_lock(&pool->mutex);
+		if (++pool->finished == pool->count) {
+			pthread_cond_signal(&pool->done);
+		}
+	}
+}
+
+static void *worker_main(void *data) {
+	struct fill_pool *pool = data;
+	pthread_mutex_lock(&pool->mutex);
+	while (!pool->stop) {
+		if (pool->next < pool->count) {
+			run_jobs(pool);
+		} else {
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+int fill_pool_init(struct fill_pool *pool, int threads) {
+	*pool = (struct fill_pool) { 0 };
+	if (threads == 0) {
+		return 0;
+	}
+
+	pool->workers = calloc(threads, sizeof(pthread_t));
+	if (pool->workers == NULL) {
+		return -1;
+	}
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (int idx = 0; idx < threads; idx++) {
+		if (pthread_create(&pool->workers[idx], NULL, worker_main, pool) != 0) {
+			fill_pool_finish(pool);
+			return -1;
+		}
+		pool->threads++;
+	}
+	return 0;
+}
+
+void fill_pool_finish(struct fill_pool *pool) {
+	if (pool->workers == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+	for (int idx = 0; idx < pool->threads; idx++) {
+		pthread_join(pool->workers[idx], NULL);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->workers);
+	*pool = (struct fill_pool) { 0 };
+}
+
+void fill_pool_run(struct fill_pool *pool, struct gamma_table **tables, size_t count) {
+	if (pool->threads == 0 || count < 2) {
+		for (size_t idx = 0; idx < count; idx++) {
+			gamma_table_fill(tables[idx]);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->tables = tables;
+	pool->count = count;
+	pool->next = 0;
+	pool->finished = 0;
+	pthread_cond_broadcast(&pool->start);
+
+	run_jobs(pool);
+	while (pool->finished < pool->count) {
+		pthread_cond_wait(&pool->done, &pool->mutex);
+	}
+	pool->tables = NULL;
+	pool->count = 0;
+	pool->next = 0;
+	pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,36 @@
+#ifndef _FILL_POOL_H
+#define _FILL_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "gamma.h"
+
+/*
+ * A fixed set of worker threads filling gamma tables in parallel. The
+ * calling thread takes part in every batch, so a pool of zero threads fills
+ * everything inline.
+ */
+struct fill_pool {
+	int threads;
+	pthread_t *workers;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t start;
+	pthread_cond_t done;
+
+	struct gamma_table **tables;
+	size_t count;
+	size_t next;
+	size_t finished;
+	bool stop;
+};
+
+int fill_pool_init(struct fill_pool *pool, int threads);
+void fill_pool_finish(struct fill_pool *pool);
+
+// Fills all tables and returns once they are done
+void fill_pool_run(struct fill_pool *pool, struct gamma_table **tables, size_t count);
+
+#endif
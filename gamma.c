@@ -0,0 +1,293 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "gamma.h"
+#include "stats.h"
+#include "trace.h"
+
+#if !defined(WLSUNSET_NO_SIMD)
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_SSE
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON
+#endif
+#endif
+
+static struct gamma_curve *curves = NULL;
+static struct gamma_table *tables = NULL;
+
+// All kernels do the same single precision multiply and truncating
+// conversion, so their output is bit-identical to scale_scalar()
+
+static void scale_scalar(uint16_t *dst, const float *src, float w, uint32_t len) {
+	for (uint32_t i = 0; i < len; ++i) {
+		int32_t v = (int32_t)(src[i] * w);
+		dst[i] = v < 0 ? 0 : v > UINT16_MAX ? UINT16_MAX : (uint16_t)v;
+	}
+}
+
+#if defined(HAVE_SSE)
+__attribute__((target("sse4.1")))
+static void scale_sse41(uint16_t *dst, const float *src, float w, uint32_t len) {
+	__m128 vw = _mm_set1_ps(w);
+	uint32_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		__m128i lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), vw));
+		__m128i hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), vw));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi32(lo, hi));
+	}
+	scale_scalar(dst + i, src + i, w, len - i);
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(uint16_t *dst, const float *src, float w, uint32_t len) {
+	__m256 vw = _mm256_set1_ps(w);
+	uint32_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m256i lo = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i), vw));
+		__m256i hi = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), vw));
+		// packus works within 128-bit lanes, restore the order afterwards
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);
+		_mm256_storeu_si256((__m256i *)(dst + i), packed);
+	}
+	scale_scalar(dst + i, src + i, w, len - i);
+}
+#endif
+
+#if defined(HAVE_NEON)
+static void scale_neon(uint16_t *dst, const float *src, float w, uint32_t len) {
+	float32x4_t vw = vdupq_n_f32(w);
+	uint32_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		int32x4_t lo = vcvtq_s32_f32(vmulq_f32(vld1q_f32(src + i), vw));
+		int32x4_t hi = vcvtq_s32_f32(vmulq_f32(vld1q_f32(src + i + 4), vw));
+		vst1q_u16(dst + i, vcombine_u16(vqmovun_s32(lo), vqmovun_s32(hi)));
+	}
+	scale_scalar(dst + i, src + i, w, len - i);
+}
+#endif
+
+size_t gamma_kernels(struct gamma_kernel kernels[GAMMA_KERNELS_MAX]) {
+	size_t len = 0;
+	kernels[len++] = (struct gamma_kernel){ "scalar", scale_scalar };
+#if defined(HAVE_SSE)
+	if (__builtin_cpu_supports("sse4.1")) {
+		kernels[len++] = (struct gamma_kernel){ "sse4.1", scale_sse41 };
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		kernels[len++] = (struct gamma_kernel){ "avx2", scale_avx2 };
+	}
+#elif defined(HAVE_NEON)
+	kernels[len++] = (struct gamma_kernel){ "neon", scale_neon };
+#endif
+	return len;
+}
+
+static gamma_scale_fn select_kernel(void) {
+#if defined(HAVE_SSE)
+	if (__builtin_cpu_supports("avx2")) {
+		return scale_avx2;
+	}
+	if (__builtin_cpu_supports("sse4.1")) {
+		return scale_sse41;
+	}
+#elif defined(HAVE_NEON)
+	return scale_neon;
+#endif
+	return scale_scalar;
+}
+
+static gamma_scale_fn scale_channel = NULL;
+
+static struct gamma_curve *gamma_curve_create(uint32_t ramp_size, double gamma) {
+	struct gamma_curve *curve = calloc(1, sizeof(struct gamma_curve));
+	if (curve == NULL) {
+		return NULL;
+	}
+	curve->curve = calloc(ramp_size, sizeof(float));
+	curve->neutral = calloc(ramp_size, sizeof(uint16_t));
+	if (curve->curve == NULL || curve->neutral == NULL) {
+		free(curve->curve);
+		free(curve->neutral);
+		free(curve);
+		return NULL;
+	}
+
+	// Selected here rather than on first fill, as fills may run on workers
+	if (scale_channel == NULL) {
+		scale_channel = select_kernel();
+	}
+
+	curve->ramp_size = ramp_size;
+	curve->gamma = gamma;
+	for (uint32_t i = 0; i < ramp_size; ++i) {
+		double val = ramp_size > 1 ? (double)i / (ramp_size - 1) : 0.0;
+		double v = pow(val, 1.0 / gamma);
+		curve->curve[i] = (float)v;
+		curve->neutral[i] = (uint16_t)(UINT16_MAX * v);
+	}
+	return curve;
+}
+
+struct gamma_curve *gamma_curve_get(uint32_t ramp_size, double gamma) {
+	for (struct gamma_curve *curve = curves; curve != NULL; curve = curve->next) {
+		if (curve->ramp_size == ramp_size && curve->gamma == gamma) {
+			curve->refcount++;
+			return curve;
+		}
+	}
+
+	struct gamma_curve *curve = gamma_curve_create(ramp_size, gamma);
+	if (curve == NULL) {
+		return NULL;
+	}
+	curve->refcount = 1;
+	curve->next = curves;
+	curves = curve;
+	return curve;
+}
+
+static void gamma_table_destroy(struct gamma_table *table) {
+	free(table->data);
+	free(table);
+}
+
+void gamma_curve_put(struct gamma_curve *curve) {
+	if (curve == NULL || --curve->refcount > 0) {
+		return;
+	}
+	for (struct gamma_curve **link = &curves; *link != NULL; link = &(*link)->next) {
+		if (*link == curve) {
+			*link = curve->next;
+			break;
+		}
+	}
+	if (curve->spare != NULL) {
+		gamma_table_destroy(curve->spare);
+	}
+	free(curve->curve);
+	free(curve->neutral);
+	free(curve);
+}
+
+static void fill_table(uint16_t *table, const struct gamma_curve *curve,
+		const struct rgb *wp) {
+	uint32_t ramp_size = curve->ramp_size;
+	uint16_t *r = table;
+	uint16_t *g = table + ramp_size;
+	uint16_t *b = table + 2 * ramp_size;
+
+	if (wp->r == 1.0 && wp->g == 1.0 && wp->b == 1.0) {
+		size_t len = ramp_size * sizeof(uint16_t);
+		memcpy(r, curve->neutral, len);
+		memcpy(g, curve->neutral, len);
+		memcpy(b, curve->neutral, len);
+		return;
+	}
+
+	scale_channel(r, curve->curve, UINT16_MAX * pow(wp->r, 1.0 / curve->gamma), ramp_size);
+	scale_channel(g, curve->curve, UINT16_MAX * pow(wp->g, 1.0 / curve->gamma), ramp_size);
+	scale_channel(b, curve->curve, UINT16_MAX * pow(wp->b, 1.0 / curve->gamma), ramp_size);
+}
+
+static uint64_t hash_table(const uint16_t *data, size_t size) {
+	// FNV-1a over 64-bit words, with a shift to fold high bits back down
+	const unsigned char *bytes = (const unsigned char *)data;
+	uint64_t hash = FNV1A_INIT;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof word);
+		hash = (hash ^ word) * FNV1A_PRIME;
+		hash ^= hash >> 29;
+	}
+	return fnv1a(hash, bytes + i, size - i);
+}
+
+static bool same_whitepoint(const struct rgb *a, const struct rgb *b) {
+	return a->r == b->r && a->g == b->g && a->b == b->b;
+}
+
+struct gamma_table *gamma_table_acquire(struct gamma_curve *curve,
+		const struct rgb *wp, bool *needs_fill) {
+	*needs_fill = false;
+	for (struct gamma_table *table = tables; table != NULL; table = table->next) {
+		if (table->curve == curve && same_whitepoint(&table->wp, wp)) {
+			table->refcount++;
+			return table;
+		}
+	}
+
+	struct gamma_table *table = curve->spare;
+	if (table != NULL) {
+		curve->spare = NULL;
+	} else {
+		table = calloc(1, sizeof(struct gamma_table));
+		if (table == NULL) {
+			return NULL;
+		}
+		table->size = curve->ramp_size * 3 * sizeof(uint16_t);
+		table->data = malloc(table->size);
+		if (table->data == NULL) {
+			free(table);
+			return NULL;
+		}
+	}
+
+	curve->refcount++;
+	table->curve = curve;
+	table->wp = *wp;
+	table->refcount = 1;
+	*needs_fill = true;
+
+	table->next = tables;
+	tables = table;
+	return table;
+}
+
+void gamma_table_fill(struct gamma_table *table) {
+	int64_t start = stats_clock();
+	fill_table(table->data, table->curve, &table->wp);
+	table->hash = hash_table(table->data, table->size);
+	trace_event(TRACE_TABLE_FILL, table->curve->ramp_size, stats_clock() - start);
+}
+
+struct gamma_table *gamma_table_get(struct gamma_curve *curve, const struct rgb *wp) {
+	bool needs_fill;
+	struct gamma_table *table = gamma_table_acquire(curve, wp, &needs_fill);
+	if (table != NULL && needs_fill) {
+		int64_t fill_start = stats_clock();
+		gamma_table_fill(table);
+		stats.table_fills++;
+		stats.table_fill_ns += stats_clock() - fill_start;
+	}
+	return table;
+}
+
+void gamma_table_put(struct gamma_table *table) {
+	if (table == NULL || --table->refcount > 0) {
+		return;
+	}
+	for (struct gamma_table **link = &tables; *link != NULL; link = &(*link)->next) {
+		if (*link == table) {
+			*link = table->next;
+			break;
+		}
+	}
+
+	struct gamma_curve *curve = table->curve;
+	table->curve = NULL;
+	table->next = NULL;
+	if (curve->spare == NULL) {
+		curve->spare = table;
+	} else {
+		gamma_table_destroy(table);
+	}
+	gamma_curve_put(curve);
+}
@@ -0,0 +1,85 @@
+#ifndef _GAMMA_H
+#define _GAMMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+
+/*
+ * pow(v * w, 1 / gamma) == pow(v, 1 / gamma) * pow(w, 1 / gamma), so the
+ * expensive part of a gamma table only depends on the ramp size and gamma.
+ * That part is computed once and shared by everyone using the same pair.
+ */
+struct gamma_curve {
+	struct gamma_curve *next;
+	int refcount;
+
+	uint32_t ramp_size;
+	double gamma;
+
+	// pow(i / (ramp_size - 1), 1 / gamma)
+	float *curve;
+	// curve scaled to UINT16_MAX, i.e. a channel for a neutral whitepoint
+	uint16_t *neutral;
+
+	// A released table kept around to avoid reallocating on every update
+	struct gamma_table *spare;
+};
+
+/*
+ * A filled gamma table, shared by every output with the same ramp size,
+ * gamma and whitepoint.
+ */
+struct gamma_table {
+	struct gamma_table *next;
+	int refcount;
+
+	struct gamma_curve *curve;
+	struct rgb wp;
+
+	// ramp_size * 3 entries, red, green and blue
+	uint16_t *data;
+	size_t size;
+	// Hash of data, cheap to compare. Equal hashes are only a hint, the
+	// content still has to be compared.
+	uint64_t hash;
+};
+
+struct gamma_curve *gamma_curve_get(uint32_t ramp_size, double gamma);
+void gamma_curve_put(struct gamma_curve *curve);
+
+struct gamma_table *gamma_table_get(struct gamma_curve *curve, const struct rgb *wp);
+
+/*
+ * Like gamma_table_get(), but a newly created table is left for the caller
+ * to fill with gamma_table_fill(), as indicated by needs_fill. Distinct
+ * tables may be filled concurrently from any thread, everything else must
+ * stay on the main thread.
+ */
+struct gamma_table *gamma_table_acquire(struct gamma_curve *curve,
+		const struct rgb *wp, bool *needs_fill);
+void gamma_table_fill(struct gamma_table *table);
+void gamma_table_put(struct gamma_table *table);
+
+/*
+ * Channel kernels: dst[i] = src[i] * w, truncated and saturated to uint16.
+ * Every variant gives bit-identical output. With the single precision base
+ * curve, a filled table is within GAMMA_TABLE_MAX_ERROR of
+ * UINT16_MAX * pow(i / (ramp_size - 1) * w, 1 / gamma) computed in double
+ * precision.
+ */
+#define GAMMA_TABLE_MAX_ERROR 1
+#define GAMMA_KERNELS_MAX 3
+
+typedef void (*gamma_scale_fn)(uint16_t *dst, const float *src, float w, uint32_t len);
+
+struct gamma_kernel {
+	const char *name;
+	gamma_scale_fn scale;
+};
+
+// The kernels built in and supported by this CPU, scalar first, for tests
+size_t gamma_kernels(struct gamma_kernel kernels[GAMMA_KERNELS_MAX]);
+
+#endif
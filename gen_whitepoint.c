@@ -0,0 +1,137 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "color.h"
+
+/*
+ * Generates whitepoint_table.h, a tabulated calc_whitepoint() for use by
+ * lookup_whitepoint().
+ *
+ * calc_whitepoint() clamps everything below 1667K, and the blue channel hits
+ * zero around 1900K where the 1/2.2 transfer function has an unbounded slope.
+ * Interpolating across that is hopeless, so the low end is tabulated for
+ * every kelvin. Above that, the curves are smooth and a coarse step with
+ * linear interpolation is sufficient.
+ *
+ * The generator checks every integer temperature in the range against the
+ * real calculation and fails if the error exceeds MAX_ERROR.
+ */
+
+#define FINE_MIN 1667
+#define COARSE_MIN 2100
+#define COARSE_STEP 10
+#define TEMP_MAX 25000
+
+// A sixteenth of an 8-bit step. Well below anything visible.
+#define MAX_ERROR (1.0 / 4096)
+
+#define FINE_LEN (COARSE_MIN - FINE_MIN)
+#define COARSE_LEN ((TEMP_MAX - COARSE_MIN) / COARSE_STEP + 1)
+
+static float fine[FINE_LEN][3];
+static float coarse[COARSE_LEN][3];
+
+static struct rgb locus_whitepoint(int temp) {
+	// calc_whitepoint() special-cases 6500K to an exact identity, which is
+	// not on the curve. Store the curve value so that the neighbours
+	// interpolate smoothly; lookup_whitepoint() keeps the special case.
+	if (temp == 6500) {
+		struct rgb a = calc_whitepoint(6499), b = calc_whitepoint(6501);
+		return (struct rgb) {
+			.r = (a.r + b.r) / 2,
+			.g = (a.g + b.g) / 2,
+			.b = (a.b + b.b) / 2,
+		};
+	}
+	return calc_whitepoint(temp);
+}
+
+static void store(float entry[3], struct rgb wp) {
+	entry[0] = (float)wp.r;
+	entry[1] = (float)wp.g;
+	entry[2] = (float)wp.b;
+}
+
+static double channel_error(const float a[3], const float b[3], double factor,
+		int channel, double expected) {
+	double v = a[channel] + (b[channel] - a[channel]) * factor;
+	return fabs(v - expected);
+}
+
+static double max_error(void) {
+	double err = 0.0;
+	for (int temp = FINE_MIN; temp <= TEMP_MAX; temp++) {
+		if (temp == 6500) {
+			continue;
+		}
+		struct rgb wp = calc_whitepoint(temp);
+		double expected[3] = { wp.r, wp.g, wp.b };
+		const float *a, *b;
+		double factor;
+		if (temp < COARSE_MIN) {
+			a = b = fine[temp - FINE_MIN];
+			factor = 0.0;
+		} else {
+			int idx = (temp - COARSE_MIN) / COARSE_STEP;
+			int rem = (temp - COARSE_MIN) % COARSE_STEP;
+			a = coarse[idx];
+			b = rem == 0 ? a : coarse[idx + 1];
+			factor = (double)rem / COARSE_STEP;
+		}
+		for (int c = 0; c < 3; c++) {
+			err = fmax(err, channel_error(a, b, factor, c, expected[c]));
+		}
+	}
+	return err;
+}
+
+static void write_table(FILE *f, const char *name, float (*table)[3], int len) {
+	fprintf(f, "static const float %s[%d][3] = {\n", name, len);
+	for (int i = 0; i < len; i++) {
+		fprintf(f, "\t{ %.9ef, %.9ef, %.9ef },\n",
+			table[i][0], table[i][1], table[i][2]);
+	}
+	fprintf(f, "};\n\n");
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <output>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < FINE_LEN; i++) {
+		store(fine[i], locus_whitepoint(FINE_MIN + i));
+	}
+	for (int i = 0; i < COARSE_LEN; i++) {
+		store(coarse[i], locus_whitepoint(COARSE_MIN + i * COARSE_STEP));
+	}
+
+	double err = max_error();
+	if (err > MAX_ERROR) {
+		fprintf(stderr, "whitepoint table error %e exceeds %e\n", err, MAX_ERROR);
+		return EXIT_FAILURE;
+	}
+
+	FILE *f = fopen(argv[1], "w");
+	if (f == NULL) {
+		perror("could not open output");
+		return EXIT_FAILURE;
+	}
+
+	fprintf(f, "// Generated by gen_whitepoint.c, do not edit.\n\n");
+	fprintf(f, "#define WHITEPOINT_FINE_MIN %d\n", FINE_MIN);
+	fprintf(f, "#define WHITEPOINT_COARSE_MIN %d\n", COARSE_MIN);
+	fprintf(f, "#define WHITEPOINT_COARSE_STEP %d\n", COARSE_STEP);
+	fprintf(f, "#define WHITEPOINT_MAX %d\n", TEMP_MAX);
+	fprintf(f, "// Largest deviation from calc_whitepoint() of any channel\n");
+	fprintf(f, "#define WHITEPOINT_MAX_ERROR %e\n\n", err);
+	write_table(f, "whitepoint_fine", fine, FINE_LEN);
+	write_table(f, "whitepoint_coarse", coarse, COARSE_LEN);
+
+	if (fclose(f) != 0) {
+		perror("could not write output");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define LOG_BUFFER_SIZE 4096
+
+static enum log_level max_level = LOG_INFO;
+
+static char buffer[LOG_BUFFER_SIZE];
+static size_t buffer_len = 0;
+
+// Lines logged in the current one second window, and lines dropped
+static bool rate_limit = true;
+static int64_t window_start = 0;
+static int window_lines = 0;
+static unsigned long dropped = 0;
+
+static const char *level_names[] = {
+	[LOG_ERROR] = "error",
+	[LOG_WARN] = "warn",
+	[LOG_INFO] = "info",
+	[LOG_DEBUG] = "debug",
+};
+
+void log_set_level(enum log_level level) {
+	max_level = level;
+}
+
+void log_set_rate_limit(bool enabled) {
+	rate_limit = enabled;
+}
+
+int log_parse_level(const char *name, enum log_level *level) {
+	for (size_t idx = 0; idx < sizeof level_names / sizeof level_names[0]; idx++) {
+		if (strcmp(name, level_names[idx]) == 0) {
+			*level = idx;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void write_buffer(void) {
+	const char *data = buffer;
+	size_t len = buffer_len;
+	while (len > 0) {
+		ssize_t written = write(STDERR_FILENO, data, len);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// Nowhere to report it, drop the rest
+			break;
+		}
+		data += written;
+		len -= written;
+	}
+	buffer_len = 0;
+}
+
+static void append(const char *fmt, va_list args) {
+	va_list retry;
+	va_copy(retry, args);
+	size_t room = sizeof buffer - buffer_len;
+	int len = vsnprintf(buffer + buffer_len, room, fmt, args);
+	if (len >= 0 && (size_t)len + 1 >= room && buffer_len > 0) {
+		// Make room and try again, overlong lines are truncated below
+		write_buffer();
+		room = sizeof buffer;
+		len = vsnprintf(buffer, room, fmt, retry);
+	}
+	va_end(retry);
+	if (len < 0) {
+		return;
+	}
+	buffer_len += (size_t)len + 1 < room ? (size_t)len : room - 2;
+	buffer[buffer_len++] = '\n';
+}
+
+static void log_append(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	append(fmt, args);
+	va_end(args);
+}
+
+void log_flush(void) {
+	write_buffer();
+	if (dropped > 0) {
+		// The buffer is empty, so this cannot flush again
+		unsigned long count = dropped;
+		dropped = 0;
+		log_append("dropped %lu log lines", count);
+		write_buffer();
+	}
+}
+
+static bool rate_limited(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	int64_t now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	if (now - window_start >= 1000000000LL) {
+		window_start = now;
+		window_lines = 0;
+	}
+	if (window_lines >= LOG_RATE_LIMIT) {
+		dropped++;
+		return true;
+	}
+	window_lines++;
+	return false;
+}
+
+void log_printf(enum log_level level, const char *fmt, ...) {
+	if (level > max_level) {
+		return;
+	}
+	// Errors are rare and always worth having
+	if (level != LOG_ERROR && rate_limit && rate_limited()) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	append(fmt, args);
+	va_end(args);
+
+	if (level == LOG_ERROR) {
+		log_flush();
+	}
+}
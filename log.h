@@ -0,0 +1,43 @@
+#ifndef _LOG_H
+#define _LOG_H
+
+#include <stdbool.h>
+
+/*
+ * Leveled logging to stderr. Lines are collected in a buffer and written
+ * together by log_flush(), which the main loop calls before blocking, so a
+ * burst of messages costs a single write. Errors are written right away.
+ *
+ * Bursts beyond LOG_RATE_LIMIT lines per second are dropped, except for
+ * errors, and the next flush reports how many. Debug messages are compiled
+ * out unless built with the debug-logs option. Main thread only.
+ */
+enum log_level {
+	LOG_ERROR,
+	LOG_WARN,
+	LOG_INFO,
+	LOG_DEBUG,
+};
+
+#define LOG_RATE_LIMIT 100
+
+void log_set_level(enum log_level level);
+// On by default, off where every line matters, such as simulations
+void log_set_rate_limit(bool enabled);
+int log_parse_level(const char *name, enum log_level *level);
+
+void log_printf(enum log_level level, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void log_flush(void);
+
+#define log_error(...) log_printf(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) log_printf(LOG_WARN, __VA_ARGS__)
+#define log_info(...) log_printf(LOG_INFO, __VA_ARGS__)
+#if defined(WLSUNSET_DEBUG_LOG)
+#define log_debug(...) log_printf(LOG_DEBUG, __VA_ARGS__)
+#else
+// Still type checked, but never evaluated
+#define log_debug(...) do { if (0) log_printf(LOG_DEBUG, __VA_ARGS__); } while (0)
+#endif
+
+#endif
@@ -1,15 +1,23 @@
+#define _GNU_SOURCE
 #define _DEFAULT_SOURCE
 #define _XOPEN_SOURCE 700
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <fnmatch.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#if defined(HAVE_INOTIFY)
+#include <sys/inotify.h>
+#endif
 #include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -17,67 +25,71 @@
 #include <wayland-client.h>
 
 #include "wlr-gamma-control-unstable-v1-client-protocol.h"
+#include "cache.h"
 #include "color.h"
+#include "control.h"
+#include "ephemeris.h"
+#include "fill_pool.h"
+#include "log.h"
+#include "event_loop.h"
+#include "gamma.h"
+#include "matcher.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "str_vec.h"
+#include "trace.h"
 
-#if defined(SPEEDRUN)
-static time_t start = 0, offset = 0, multiplier = 1000;
-static void init_time(void) {
-	tzset();
-	struct timespec realtime;
-	clock_gettime(CLOCK_REALTIME, &realtime);
-	offset = realtime.tv_sec;
-
-	char *startstr = getenv("SPEEDRUN_START");
-	if (startstr != NULL) {
-		start = atol(startstr);
-	} else {
-		start = offset;
-	}
+#define NSEC_PER_SEC 1000000000LL
 
-	char *multistr = getenv("SPEEDRUN_MULTIPLIER");
-	if (multistr != NULL) {
-		multiplier = atol(multistr);
-	}
-}
-static time_t get_time_sec(void) {
+static int64_t get_real_time_ns(void) {
 	struct timespec realtime;
 	clock_gettime(CLOCK_REALTIME, &realtime);
-	time_t now = start + ((realtime.tv_sec - offset) * multiplier +
-			realtime.tv_nsec / (1000000000 / multiplier));
-	struct tm tm;
-	localtime_r(&now, &tm);
-	fprintf(stderr, "time in termina: %02d:%02d:%02d, %d/%d/%d\n",
-			tm.tm_hour, tm.tm_min, tm.tm_sec, tm.tm_mday,
-			tm.tm_mon+1, tm.tm_year + 1900);
-	return now;
-}
-static void adjust_timerspec(struct itimerspec *timerspec) {
-	int diff = timerspec->it_value.tv_sec - offset;
-	timerspec->it_value.tv_sec = offset + diff / multiplier;
-	timerspec->it_value.tv_nsec = (diff % multiplier) * (1000000000 / multiplier);
+	return realtime.tv_sec * NSEC_PER_SEC + realtime.tv_nsec;
 }
-#else
-static inline void init_time(void) {
-	tzset();
-}
-static inline time_t get_time_sec(void) {
-	struct timespec realtime;
-	clock_gettime(CLOCK_REALTIME, &realtime);
-	return realtime.tv_sec;
+
+/*
+ * The clock everything is calculated against. It is the real time, unless
+ * a simulation (-x) has set a virtual one.
+ */
+static int64_t virtual_time = 0;
+
+static int64_t get_time_ns(void) {
+	return virtual_time != 0 ? virtual_time : get_real_time_ns();
 }
-static inline void adjust_timerspec(struct itimerspec *timerspec) {
-	(void)timerspec;
+
+static inline int64_t sec_to_ns(time_t sec) {
+	return (int64_t)sec * NSEC_PER_SEC;
 }
-#endif
 
-static time_t get_timezone(void) {
+static time_t get_timezone(time_t now) {
 	struct tm tm;
-	time_t now = time(NULL);
 	localtime_r(&now, &tm);
 	return tm.tm_gmtoff;
 }
 
+/*
+ * Manual times follow local time, so its UTC offset changing, e.g. for
+ * daylight saving time, is a deadline of its own. Finds the first second
+ * before deadline at which the offset differs from the one at now.
+ */
+static int64_t next_timezone_change(int64_t now, int64_t deadline) {
+	time_t lo = now / NSEC_PER_SEC;
+	time_t hi = (deadline + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+	time_t offset = get_timezone(lo);
+	if (get_timezone(hi) == offset) {
+		return deadline;
+	}
+	while (hi - lo > 1) {
+		time_t mid = lo + (hi - lo) / 2;
+		if (get_timezone(mid) == offset) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return sec_to_ns(hi) < deadline ? sec_to_ns(hi) : deadline;
+}
+
 static time_t round_day_offset(time_t now, time_t offset) {
 	return now - ((now - offset) % 86400);
 }
@@ -90,14 +102,31 @@ static time_t longitude_time_offset(double longitude) {
 	return -longitude * 43200 / M_PI;
 }
 
-static int max(int a, int b) {
-	return a > b ? a : b;
-}
+/*
+ * Temperatures and gamma for a group of outputs. The first profile holds the
+ * global settings and applies to every output not matched by another one.
+ */
+struct profile {
+	// Output name or description glob, NULL for the global profile
+	char *pattern;
+	int low_temp;
+	int high_temp;
+	double gamma;
+
+	// Outputs currently using the profile
+	int users;
+	// The temperature and whitepoint last applied
+	int temp;
+	struct rgb wp;
+	// Set while the current update has a new whitepoint to apply
+	bool changed;
+};
 
 struct config {
 	int high_temp;
 	int low_temp;
 	double gamma;
+	int threads;
 
 	double longitude;
 	double latitude;
@@ -107,10 +136,21 @@ struct config {
 	time_t sunset;
 	time_t duration;
 
+	int max_rate;
+	double min_change;
+
 	double elevation_twilight;
 	double elevation_daylight;
 
 	struct str_vec output_names;
+	struct profile *profiles;
+	size_t profiles_len;
+
+	char *control_path;
+
+	// Simulate this many days from simulation_start instead of running
+	int simulation_days;
+	time_t simulation_start;
 };
 
 enum state {
@@ -125,50 +165,171 @@ enum force_state {
 	FORCE_OFF,
 	FORCE_HIGH,
 	FORCE_LOW,
+	FORCE_TEMP,
+};
+
+// Outputs indexed by registry name, next to the ordered outputs list
+struct output_map {
+	struct output **buckets;
+	uint32_t mask;
+	uint32_t count;
 };
 
 struct context {
 	struct config config;
 	struct sun sun;
+	struct ephemeris ephemeris;
 
 	time_t longitude_time_offset;
 
 	enum state state;
 	enum sun_condition condition;
 
-	time_t dawn_step_time;
-	time_t night_step_time;
 	time_t calc_day;
 
-	bool new_output;
+	// Minimum time between two updates during a transition
+	int64_t min_step_time;
+	// The currently armed timer deadline in real time
+	int64_t timer_deadline;
+
+	double pos;
+	bool paused;
+	// Running against the virtual clock, without a display
+	bool simulation;
+	// Set when at least one output is dirty
+	bool outputs_dirty;
+	// Restored from a snapshot, updates wait until outputs have it
+	bool warm_pending;
+	bool running;
 	struct wl_list outputs;
-	timer_t timer;
+
+	struct event_loop loop;
+	struct event_source display_source;
+	struct event_source timer_source;
+	struct event_source signal_source;
+	struct event_source tz_source;
+	uint32_t display_events;
+	struct wl_display *display;
 
 	enum force_state forced_state;
+	int forced_temp;
 
 	struct zwlr_gamma_control_manager_v1 *gamma_control_manager;
+
+	struct output_map output_map;
+	struct name_matcher output_matcher;
+
+	struct fill_pool fill_pool;
+	// Tables to fill in the current update, room for one per output
+	struct gamma_table **fill_jobs;
+	size_t fill_jobs_len;
+
+	char *stats_path;
+	char *trace_path;
+	struct control control;
+	struct snapshot snapshot;
+};
+
+// Tables are rotated between buffers so that a table the compositor may not
+// have read yet is never overwritten.
+#define GAMMA_BUFFERS 2
+
+struct gamma_buffer {
+	int fd;
+	uint16_t *data;
 };
 
 struct output {
 	struct wl_list link;
+	struct output *map_next;
 
 	struct context *context;
 	struct wl_output *wl_output;
 	struct zwlr_gamma_control_v1 *gamma_control;
 
-	int table_fd;
+	struct gamma_buffer buffers[GAMMA_BUFFERS];
+	int next_buffer;
 	uint32_t id;
 	uint32_t ramp_size;
-	uint16_t *table;
+	struct profile *profile;
+	struct gamma_curve *curve;
+	// The table last sent to the compositor
+	struct gamma_table *gamma_table;
+	// The table for the update in progress
+	struct gamma_table *pending_table;
+	// Holds the new table, waiting for commit_outputs() to send it
+	struct gamma_buffer *pending_buffer;
+	// New gamma buffers, waiting for the current table to be sent
+	bool dirty;
 	bool enabled;
 	char *name;
+	// Monotonic time the output was announced
+	int64_t added;
+
+	struct output_stats stats;
 };
 
+static int output_map_grow(struct output_map *map) {
+	uint32_t len = map->buckets == NULL ? 16 : (map->mask + 1) * 2;
+	struct output **buckets = calloc(len, sizeof(struct output *));
+	if (buckets == NULL) {
+		return -1;
+	}
+	for (uint32_t idx = 0; map->buckets != NULL && idx <= map->mask; idx++) {
+		struct output *output = map->buckets[idx];
+		while (output != NULL) {
+			struct output *next = output->map_next;
+			// Registry names are handed out sequentially, no need to mix them
+			uint32_t bucket = output->id & (len - 1);
+			output->map_next = buckets[bucket];
+			buckets[bucket] = output;
+			output = next;
+		}
+	}
+	free(map->buckets);
+	map->buckets = buckets;
+	map->mask = len - 1;
+	return 0;
+}
+
+static int output_map_insert(struct output_map *map, struct output *output) {
+	if ((map->buckets == NULL || map->count > map->mask) &&
+			output_map_grow(map) == -1) {
+		return -1;
+	}
+	uint32_t bucket = output->id & map->mask;
+	output->map_next = map->buckets[bucket];
+	map->buckets[bucket] = output;
+	map->count++;
+	return 0;
+}
+
+static struct output *output_map_find(const struct output_map *map, uint32_t id) {
+	if (map->buckets == NULL) {
+		return NULL;
+	}
+	struct output *output = map->buckets[id & map->mask];
+	while (output != NULL && output->id != id) {
+		output = output->map_next;
+	}
+	return output;
+}
+
+static void output_map_remove(struct output_map *map, struct output *output) {
+	struct output **link = &map->buckets[output->id & map->mask];
+	while (*link != NULL) {
+		if (*link == output) {
+			*link = output->map_next;
+			map->count--;
+			return;
+		}
+		link = &(*link)->map_next;
+	}
+}
+
 static void print_trajectory(struct context *ctx, time_t now) {
 	struct tm tm_now;
 	localtime_r(&now, &tm_now);
-	fprintf(stderr, "calculated sun trajectory at %02d:%02d: ",
-		tm_now.tm_hour, tm_now.tm_min);
 	struct tm dawn, sunrise, sunset, night;
 	switch (ctx->condition) {
 	case NORMAL:
@@ -176,26 +337,27 @@ static void print_trajectory(struct context *ctx, time_t now) {
 		localtime_r(&ctx->sun.sunrise, &sunrise);
 		localtime_r(&ctx->sun.sunset, &sunset);
 		localtime_r(&ctx->sun.night, &night);
-		fprintf(stderr,
-			"dawn %02d:%02d, sunrise %02d:%02d, sunset %02d:%02d, night %02d:%02d\n",
+		log_info("calculated sun trajectory at %02d:%02d: "
+			"dawn %02d:%02d, sunrise %02d:%02d, sunset %02d:%02d, night %02d:%02d",
+			tm_now.tm_hour, tm_now.tm_min,
 			dawn.tm_hour, dawn.tm_min,
 			sunrise.tm_hour, sunrise.tm_min,
 			sunset.tm_hour, sunset.tm_min,
 			night.tm_hour, night.tm_min);
 		break;
 	case MIDNIGHT_SUN:
-		fprintf(stderr, "midnight sun\n");
+		log_info("calculated sun trajectory at %02d:%02d: midnight sun",
+			tm_now.tm_hour, tm_now.tm_min);
 		return;
 	case POLAR_NIGHT:
-		fprintf(stderr, "polar night\n");
+		log_info("calculated sun trajectory at %02d:%02d: polar night",
+			tm_now.tm_hour, tm_now.tm_min);
 		return;
 	default:
 		abort();
 	}
 }
 
-static int anim_kelvin_step = 10;
-
 static void recalc_stops(struct context *ctx, time_t now) {
 	time_t day = round_day_offset(now, ctx->longitude_time_offset);
 	if (day == ctx->calc_day) {
@@ -209,6 +371,7 @@ static void recalc_stops(struct context *ctx, time_t now) {
 
 	time_t last_day = ctx->calc_day;
 	ctx->calc_day = day;
+	trace_event(TRACE_RECALC_STOPS, 0, day);
 
 	enum sun_condition cond = NORMAL;
 
@@ -225,7 +388,7 @@ static void recalc_stops(struct context *ctx, time_t now) {
 	struct sun sun;
 	struct tm tm = { 0 };
 	gmtime_r(&day, &tm);
-	cond = calc_sun(&tm, ctx->config.latitude, ctx->config.elevation_twilight, ctx->config.elevation_daylight, &sun);
+	cond = ephemeris_get(&ctx->ephemeris, &tm, &sun);
 
 	switch (cond) {
 	case NORMAL:
@@ -244,7 +407,7 @@ static void recalc_stops(struct context *ctx, time_t now) {
 		break;
 	case MIDNIGHT_SUN:
 		if (ctx->condition == POLAR_NIGHT) {
-			fprintf(stderr, "warning: direct polar night to midnight sun transition\n");
+			log_warn("warning: direct polar night to midnight sun transition");
 		}
 
 		if (ctx->state != STATE_NORMAL) {
@@ -259,7 +422,7 @@ static void recalc_stops(struct context *ctx, time_t now) {
 		break;
 	case POLAR_NIGHT:
 		if (ctx->condition == MIDNIGHT_SUN) {
-			fprintf(stderr, "warning: direct midnight sun to polar night transition\n");
+			log_warn("warning: direct midnight sun to polar night transition");
 		}
 		ctx->state = STATE_STATIC;
 		break;
@@ -270,16 +433,10 @@ static void recalc_stops(struct context *ctx, time_t now) {
 done:
 	ctx->condition = cond;
 
-	int temp_diff = ctx->config.high_temp - ctx->config.low_temp;
-	ctx->dawn_step_time = max(1, (ctx->sun.sunrise - ctx->sun.dawn) *
-		anim_kelvin_step / temp_diff);
-	ctx->night_step_time = max(1, (ctx->sun.night - ctx->sun.sunset) *
-		anim_kelvin_step / temp_diff);
-
 	print_trajectory(ctx, now);
 }
 
-static double interpolate_position(time_t now, time_t start, time_t stop) {
+static double interpolate_position(int64_t now, int64_t start, int64_t stop) {
 	if (start == stop) {
 		return stop;
 	}
@@ -292,24 +449,26 @@ static double interpolate_position(time_t now, time_t start, time_t stop) {
 	return time_pos;
 }
 
-static double get_position_normal(const struct context *ctx, time_t now) {
-	if (now < ctx->sun.dawn) {
+static double get_position_normal(const struct context *ctx, int64_t now) {
+	if (now < sec_to_ns(ctx->sun.dawn)) {
 		return 0.0;
-	} else if (now < ctx->sun.sunrise) {
-		return interpolate_position(now, ctx->sun.dawn, ctx->sun.sunrise);
-	} else if (now < ctx->sun.sunset) {
+	} else if (now < sec_to_ns(ctx->sun.sunrise)) {
+		return interpolate_position(now, sec_to_ns(ctx->sun.dawn),
+			sec_to_ns(ctx->sun.sunrise));
+	} else if (now < sec_to_ns(ctx->sun.sunset)) {
 		return 1.0;
-	} else if (now < ctx->sun.night) {
-		return interpolate_position(now, ctx->sun.night, ctx->sun.sunset);
+	} else if (now < sec_to_ns(ctx->sun.night)) {
+		return interpolate_position(now, sec_to_ns(ctx->sun.night),
+			sec_to_ns(ctx->sun.sunset));
 	} else {
 		return 0.0;
 	}
 }
 
-static double get_position_transition(const struct context *ctx, time_t now) {
+static double get_position_transition(const struct context *ctx, int64_t now) {
 	switch (ctx->condition) {
 	case MIDNIGHT_SUN:
-		if (now < ctx->sun.sunrise) {
+		if (now < sec_to_ns(ctx->sun.sunrise)) {
 			return get_position_normal(ctx, now);
 		}
 		return 1.0;
@@ -318,7 +477,7 @@ static double get_position_transition(const struct context *ctx, time_t now) {
 	}
 }
 
-static double get_position(const struct context *ctx, time_t now) {
+static double get_position(const struct context *ctx, int64_t now) {
 	switch (ctx->state) {
 	case STATE_NORMAL:
 		return get_position_normal(ctx, now);
@@ -332,6 +491,9 @@ static double get_position(const struct context *ctx, time_t now) {
 			return 1.0;
 		case FORCE_LOW:
 			return 0.0;
+		case FORCE_TEMP:
+			return (double)(ctx->forced_temp - ctx->config.low_temp) /
+				(ctx->config.high_temp - ctx->config.low_temp);
 		default:
 			abort();
 		}
@@ -340,41 +502,156 @@ static double get_position(const struct context *ctx, time_t now) {
 	}
 }
 
-static int get_temp_from_pos(const struct context *ctx, double pos) {
-	int start = ctx->config.low_temp, stop = ctx->config.high_temp;
+static int get_temp_from_pos(const struct context *ctx,
+		const struct profile *profile, double pos) {
+	if (ctx->state == STATE_FORCED && ctx->forced_state == FORCE_TEMP) {
+		return ctx->forced_temp;
+	}
+	int start = profile->low_temp, stop = profile->high_temp;
 	return start + (double)(stop - start) * pos;
 }
 
-static time_t get_deadline_normal(const struct context *ctx, time_t now) {
-	if (now < ctx->sun.dawn) {
-		return ctx->sun.dawn;
-	} else if (now < ctx->sun.sunrise) {
-		return now + ctx->dawn_step_time;
-	} else if (now < ctx->sun.sunset) {
-		return ctx->sun.sunset;
-	} else if (now < ctx->sun.night) {
-		return now + ctx->night_step_time;
+// Profiles nobody uses are skipped, except the global one
+static bool profile_active(const struct context *ctx, const struct profile *profile) {
+	return profile->users > 0 || profile == &ctx->config.profiles[0];
+}
+
+// The smallest channel change the finest gamma ramp in use can represent
+static double ramp_resolution(const struct context *ctx) {
+	uint32_t ramp_size = 0;
+	struct output *output;
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (output->enabled && output->curve != NULL && output->ramp_size > ramp_size) {
+			ramp_size = output->ramp_size;
+		}
+	}
+	if (ramp_size < 2) {
+		return 0.0;
+	}
+	// A ramp of n entries is taken to drive a log2(n) bit hardware LUT
+	int bits = 1;
+	while ((1u << bits) < ramp_size && bits < 16) {
+		bits++;
+	}
+	return 1.0 / ((1 << bits) - 1);
+}
+
+/*
+ * Whether going from one temperature to another is worth an update. The
+ * whitepoint has to move by the configured distance, and by at least one
+ * step of the finest ramp, as anything less never reaches the hardware.
+ */
+static bool visible_change(const struct context *ctx, const struct rgb *from,
+		const struct chromaticity *from_uv, int to, double resolution) {
+	struct rgb b = lookup_whitepoint(to);
+	double channel = fmax(fabs(from->r - b.r),
+		fmax(fabs(from->g - b.g), fabs(from->b - b.b)));
+	if (channel <= 0.0 || channel < resolution) {
+		return false;
+	}
+	struct chromaticity uv = whitepoint_chromaticity(&b);
+	return hypot(from_uv->u - uv.u, from_uv->v - uv.v) >= ctx->config.min_change;
+}
+
+/*
+ * Rather than polling, find the first time at which the temperature will
+ * have made a visible change. The position goes from 0 at start to 1 at
+ * stop, and end is where the transition is over. Updates are spaced at least
+ * min_step_time apart.
+ */
+static int64_t get_profile_deadline_step(const struct context *ctx,
+		const struct profile *profile, double resolution, int64_t now,
+		int64_t start, int64_t stop, int64_t end) {
+	int low = profile->low_temp, high = profile->high_temp;
+	bool rising = stop > start;
+	int from = get_temp_from_pos(ctx, profile, interpolate_position(now, start, stop));
+	int last = rising ? high : low;
+	if (from == last) {
+		return end;
+	}
+	// The starting point is the same for every step of the bisection
+	struct rgb from_wp = lookup_whitepoint(from);
+	struct chromaticity from_uv = whitepoint_chromaticity(&from_wp);
+	if (!visible_change(ctx, &from_wp, &from_uv, last, resolution)) {
+		return end;
+	}
+
+	// The whitepoint moves monotonically along the way, so bisect for the
+	// nearest temperature that is visibly different
+	int near = from, far = last;
+	while (abs(far - near) > 1) {
+		int mid = near + (far - near) / 2;
+		if (visible_change(ctx, &from_wp, &from_uv, mid, resolution)) {
+			far = mid;
+		} else {
+			near = mid;
+		}
+	}
+
+	// The temperature is the position truncated to whole kelvin
+	double steps = rising ? far - low : far - low + 1;
+	double change = start + steps / (high - low) * (double)(stop - start);
+	int64_t deadline = (int64_t)floor(change) + 1;
+
+	if (deadline < now + ctx->min_step_time) {
+		deadline = now + ctx->min_step_time;
+	}
+	return deadline < end ? deadline : end;
+}
+
+// Profiles with a wider temperature range change sooner, the earliest wins
+static int64_t get_deadline_step(const struct context *ctx, int64_t now,
+		int64_t start, int64_t stop, int64_t end) {
+	double resolution = ramp_resolution(ctx);
+	int64_t deadline = end;
+	for (size_t idx = 0; idx < ctx->config.profiles_len; idx++) {
+		const struct profile *profile = &ctx->config.profiles[idx];
+		if (!profile_active(ctx, profile)) {
+			continue;
+		}
+		int64_t step = get_profile_deadline_step(ctx, profile, resolution,
+			now, start, stop, end);
+		if (step < deadline) {
+			deadline = step;
+		}
+	}
+	return deadline;
+}
+
+static int64_t get_deadline_normal(const struct context *ctx, int64_t now) {
+	int64_t dawn = sec_to_ns(ctx->sun.dawn);
+	int64_t sunrise = sec_to_ns(ctx->sun.sunrise);
+	int64_t sunset = sec_to_ns(ctx->sun.sunset);
+	int64_t night = sec_to_ns(ctx->sun.night);
+	if (now < dawn) {
+		return dawn;
+	} else if (now < sunrise) {
+		return get_deadline_step(ctx, now, dawn, sunrise, sunrise);
+	} else if (now < sunset) {
+		return sunset;
+	} else if (now < night) {
+		return get_deadline_step(ctx, now, night, sunset, night);
 	} else {
-		return tomorrow(now, ctx->longitude_time_offset);
+		return sec_to_ns(tomorrow(now / NSEC_PER_SEC, ctx->longitude_time_offset));
 	}
 }
 
-static time_t get_deadline_transition(const struct context *ctx, time_t now) {
+static int64_t get_deadline_transition(const struct context *ctx, int64_t now) {
 	switch (ctx->condition) {
 	case MIDNIGHT_SUN:
-		if (now < ctx->sun.sunrise) {
+		if (now < sec_to_ns(ctx->sun.sunrise)) {
 			return get_deadline_normal(ctx, now);
 		}
 		// fallthrough
 	case POLAR_NIGHT:
-		return tomorrow(now, ctx->longitude_time_offset);
+		return sec_to_ns(tomorrow(now / NSEC_PER_SEC, ctx->longitude_time_offset));
 	default:
 		abort();
 	}
 }
 
-static void update_timer(const struct context *ctx, timer_t timer, time_t now) {
-	time_t deadline;
+static void update_timer(struct context *ctx, int timer_fd, int64_t now) {
+	int64_t deadline;
 	switch (ctx->state) {
 	case STATE_NORMAL:
 		deadline = get_deadline_normal(ctx, now);
@@ -384,37 +661,72 @@ static void update_timer(const struct context *ctx, timer_t timer, time_t now) {
 		break;
 	case STATE_STATIC:
 	case STATE_FORCED:
-		deadline = tomorrow(now, ctx->longitude_time_offset);
+		deadline = sec_to_ns(tomorrow(now / NSEC_PER_SEC, ctx->longitude_time_offset));
 		break;
 	default:
 		abort();
 	}
 
+	if (ctx->config.manual_time) {
+		deadline = next_timezone_change(now, deadline);
+	}
+
 	assert(deadline > now);
+	ctx->timer_deadline = deadline;
+	if (timer_fd == -1) {
+		// Simulations jump to the deadline instead
+		return;
+	}
 	struct itimerspec timerspec = {
 		.it_interval = {0},
 		.it_value = {
-			.tv_sec = deadline,
-			.tv_nsec = 0,
+			.tv_sec = deadline / NSEC_PER_SEC,
+			.tv_nsec = deadline % NSEC_PER_SEC,
 		}
 	};
-	adjust_timerspec(&timerspec);
-	timer_settime(timer, TIMER_ABSTIME, &timerspec, NULL);
+	// Setting the clock, which includes resuming from suspend, cancels the
+	// timer so that we can recalculate right away
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+		&timerspec, NULL);
 }
 
-static int create_anonymous_file(off_t size) {
-	char template[] = "/tmp/wlsunset-shared-XXXXXX";
-	int fd = mkstemp(template);
-	if (fd < 0) {
-		return -1;
-	}
+static void disarm_timer(struct context *ctx, int timer_fd) {
+	struct itimerspec timerspec = { 0 };
+	ctx->timer_deadline = 0;
+	timerfd_settime(timer_fd, 0, &timerspec, NULL);
+}
 
+static int allocate_file(int fd, off_t size) {
 	int ret;
 	do {
 		errno = 0;
 		ret = ftruncate(fd, size);
 	} while (errno == EINTR);
-	if (ret < 0) {
+	return ret;
+}
+
+static int create_anonymous_file(off_t size) {
+	int fd;
+#if defined(HAVE_MEMFD_CREATE)
+	fd = memfd_create("wlsunset-gamma", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd >= 0) {
+		if (allocate_file(fd, size) < 0) {
+			close(fd);
+			return -1;
+		}
+		// The size never changes, so let the compositor rely on it
+		fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+		return fd;
+	}
+#endif
+
+	char template[] = "/tmp/wlsunset-shared-XXXXXX";
+	fd = mkstemp(template);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (allocate_file(fd, size) < 0) {
 		close(fd);
 		return -1;
 	}
@@ -423,34 +735,54 @@ static int create_anonymous_file(off_t size) {
 	return fd;
 }
 
-static int create_gamma_table(uint32_t ramp_size, uint16_t **table) {
+static int create_gamma_buffer(struct gamma_buffer *buffer, uint32_t ramp_size) {
 	size_t table_size = ramp_size * 3 * sizeof(uint16_t);
 	int fd = create_anonymous_file(table_size);
 	if (fd < 0) {
-		fprintf(stderr, "failed to create anonymous file\n");
+		log_error("failed to create anonymous file");
 		return -1;
 	}
 
 	void *data =
 		mmap(NULL, table_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 	if (data == MAP_FAILED) {
-		fprintf(stderr, "failed to mmap()\n");
+		log_error("failed to mmap()");
 		close(fd);
 		return -1;
 	}
 
-	*table = data;
-	return fd;
+#if defined(F_SEAL_FUTURE_WRITE)
+	// Our mapping stays writable, but nobody else can write to the file
+	fcntl(fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE);
+#endif
+
+	buffer->fd = fd;
+	buffer->data = data;
+	return 0;
+}
+
+static void destroy_gamma_table(struct output *output) {
+	for (int idx = 0; idx < GAMMA_BUFFERS; idx++) {
+		struct gamma_buffer *buffer = &output->buffers[idx];
+		if (buffer->fd == -1) {
+			continue;
+		}
+		munmap(buffer->data, output->ramp_size * 3 * sizeof(uint16_t));
+		close(buffer->fd);
+		buffer->fd = -1;
+		buffer->data = NULL;
+	}
+	gamma_table_put(output->gamma_table);
+	output->gamma_table = NULL;
+	gamma_curve_put(output->curve);
+	output->curve = NULL;
 }
 
 static void gamma_control_handle_gamma_size(void *data,
 		struct zwlr_gamma_control_v1 *gamma_control, uint32_t ramp_size) {
 	(void)gamma_control;
 	struct output *output = data;
-	if (output->table_fd != -1) {
-		close(output->table_fd);
-		output->table_fd = -1;
-	}
+	destroy_gamma_table(output);
 	output->ramp_size = ramp_size;
 	if (ramp_size == 0) {
 		// Maybe the output does not currently have a CRTC to tell us
@@ -459,10 +791,19 @@ static void gamma_control_handle_gamma_size(void *data,
 		output->gamma_control = NULL;
 		return;
 	}
-	output->table_fd = create_gamma_table(ramp_size, &output->table);
-	output->context->new_output = true;
-	if (output->table_fd < 0) {
-		fprintf(stderr, "could not create gamma table for output %s (%d)\n",
+	for (int idx = 0; idx < GAMMA_BUFFERS; idx++) {
+		if (create_gamma_buffer(&output->buffers[idx], ramp_size) == -1) {
+			log_error("could not create gamma table for output %s (%d)",
+					output->name, output->id);
+			exit(EXIT_FAILURE);
+		}
+	}
+	output->next_buffer = 0;
+	output->curve = gamma_curve_get(ramp_size, output->profile->gamma);
+	output->dirty = true;
+	output->context->outputs_dirty = true;
+	if (output->curve == NULL) {
+		log_error("could not create gamma table for output %s (%d)",
 				output->name, output->id);
 		exit(EXIT_FAILURE);
 	}
@@ -472,14 +813,13 @@ static void gamma_control_handle_failed(void *data,
 		struct zwlr_gamma_control_v1 *gamma_control) {
 	(void)gamma_control;
 	struct output *output = data;
-	fprintf(stderr, "gamma control of output %s (%d) failed\n",
+	log_error("gamma control of output %s (%d) failed",
 			output->name, output->id);
+	trace_event(TRACE_GAMMA_FAILED, output->id, 0);
+	output->stats.failures++;
 	zwlr_gamma_control_v1_destroy(output->gamma_control);
 	output->gamma_control = NULL;
-	if (output->table_fd != -1) {
-		close(output->table_fd);
-		output->table_fd = -1;
-	}
+	destroy_gamma_table(output);
 }
 
 static const struct zwlr_gamma_control_v1_listener gamma_control_listener = {
@@ -492,7 +832,7 @@ static void setup_gamma_control(struct context *ctx, struct output *output) {
 		return;
 	}
 	if (ctx->gamma_control_manager == NULL) {
-		fprintf(stderr, "skipping setup of output %s (%d): gamma_control_manager missing\n",
+		log_warn("skipping setup of output %s (%d): gamma_control_manager missing",
 				output->name, output->id);
 		return;
 	}
@@ -500,6 +840,7 @@ static void setup_gamma_control(struct context *ctx, struct output *output) {
 		ctx->gamma_control_manager, output->wl_output);
 	zwlr_gamma_control_v1_add_listener(output->gamma_control,
 		&gamma_control_listener, output);
+	output->stats.setups++;
 }
 
 static void wl_output_handle_geometry(void *data, struct wl_output *output, int x, int y, int width,
@@ -526,31 +867,45 @@ static void wl_output_handle_scale(void *data, struct wl_output *output, int sca
 	(void)data, (void)output, (void)scale;
 }
 
+// The first profile matching the output wins, the name is seen before the description
+static void output_match_profile(struct output *output, const char *str, const char *kind) {
+	struct config *config = &output->context->config;
+	if (output->profile != &config->profiles[0]) {
+		return;
+	}
+	for (size_t idx = 1; idx < config->profiles_len; idx++) {
+		struct profile *profile = &config->profiles[idx];
+		if (strcmp(profile->pattern, str) == 0 ||
+				fnmatch(profile->pattern, str, 0) == 0) {
+			log_info("using profile %s for output %s by %s",
+					profile->pattern, str, kind);
+			output->profile->users--;
+			output->profile = profile;
+			profile->users++;
+			return;
+		}
+	}
+}
+
 static void wl_output_handle_name(void *data, struct wl_output *wl_output, const char *name) {
 	(void)wl_output;
 	struct output *output = data;
 	output->name = strdup(name);
-	struct config *cfg = &output->context->config;
-	for (size_t idx = 0; idx < cfg->output_names.len; ++idx) {
-		if (strcmp(output->name, cfg->output_names.data[idx]) == 0) {
-			fprintf(stderr, "enabling output %s by name\n", output->name);
-			output->enabled = true;
-			return;
-		}
+	if (name_matcher_match(&output->context->output_matcher, name)) {
+		log_info("enabling output %s by name", name);
+		output->enabled = true;
 	}
+	output_match_profile(output, name, "name");
 }
 
 static void wl_output_handle_description(void *data, struct wl_output *wl_output, const char *description) {
 	(void)wl_output;
 	struct output *output = data;
-	struct config *cfg = &output->context->config;
-	for (size_t idx = 0; idx < cfg->output_names.len; ++idx) {
-		if (strcmp(description, cfg->output_names.data[idx]) == 0) {
-			fprintf(stderr, "enabling output %s by description\n", description);
-			output->enabled = true;
-			return;
-		}
+	if (name_matcher_match(&output->context->output_matcher, description)) {
+		log_info("enabling output %s by description", description);
+		output->enabled = true;
 	}
+	output_match_profile(output, description, "description");
 }
 
 struct wl_output_listener wl_output_listener = {
@@ -567,12 +922,27 @@ static void registry_handle_global(void *data, struct wl_registry *registry,
 	(void)version;
 	struct context *ctx = (struct context *)data;
 	if (strcmp(interface, wl_output_interface.name) == 0) {
-		fprintf(stderr, "registry: adding output %d\n", name);
+		log_info("registry: adding output %d", name);
+		trace_event(TRACE_OUTPUT_ADDED, name, 0);
 
 		struct output *output = calloc(1, sizeof(struct output));
+		if (output == NULL) {
+			log_error("could not allocate output %d", name);
+			return;
+		}
 		output->id = name;
-		output->table_fd = -1;
+		output->added = stats_clock();
+		for (int idx = 0; idx < GAMMA_BUFFERS; idx++) {
+			output->buffers[idx].fd = -1;
+		}
 		output->context = ctx;
+		output->profile = &ctx->config.profiles[0];
+		if (output_map_insert(&ctx->output_map, output) == -1) {
+			log_error("could not allocate output %d", name);
+			free(output);
+			return;
+		}
+		output->profile->users++;
 
 		if (version >= WL_OUTPUT_NAME_SINCE_VERSION) {
 			output->enabled = ctx->config.output_names.len == 0;
@@ -580,7 +950,7 @@ static void registry_handle_global(void *data, struct wl_registry *registry,
 					&wl_output_interface, WL_OUTPUT_NAME_SINCE_VERSION);
 			wl_output_add_listener(output->wl_output, &wl_output_listener, output);
 		} else {
-			fprintf(stderr, "wl_output: old version (%d < %d), disabling name support\n",
+			log_warn("wl_output: old version (%d < %d), disabling name support",
 					version, WL_OUTPUT_NAME_SINCE_VERSION);
 			output->enabled = true;
 			output->wl_output = wl_registry_bind(registry, name,
@@ -600,22 +970,22 @@ static void registry_handle_global_remove(void *data,
 		struct wl_registry *registry, uint32_t name) {
 	(void)registry;
 	struct context *ctx = (struct context *)data;
-	struct output *output, *tmp;
-	wl_list_for_each_safe(output, tmp, &ctx->outputs, link) {
-		if (output->id == name) {
-			fprintf(stderr, "registry: removing output %s (%d)\n", output->name, name);
-			free(output->name);
-			wl_list_remove(&output->link);
-			if (output->gamma_control != NULL) {
-				zwlr_gamma_control_v1_destroy(output->gamma_control);
-			}
-			if (output->table_fd != -1) {
-				close(output->table_fd);
-			}
-			free(output);
-			break;
-		}
+	struct output *output = output_map_find(&ctx->output_map, name);
+	if (output == NULL) {
+		return;
+	}
+
+	log_info("registry: removing output %s (%d)", output->name, name);
+	trace_event(TRACE_OUTPUT_REMOVED, name, 0);
+	free(output->name);
+	output_map_remove(&ctx->output_map, output);
+	output->profile->users--;
+	wl_list_remove(&output->link);
+	if (output->gamma_control != NULL) {
+		zwlr_gamma_control_v1_destroy(output->gamma_control);
 	}
+	destroy_gamma_table(output);
+	free(output);
 }
 
 static const struct wl_registry_listener registry_listener = {
@@ -623,274 +993,1014 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = registry_handle_global_remove,
 };
 
-static void fill_gamma_table(uint16_t *table, uint32_t ramp_size, double rw,
-		double gw, double bw, double gamma) {
-	uint16_t *r = table;
-	uint16_t *g = table + ramp_size;
-	uint16_t *b = table + 2 * ramp_size;
-	for (uint32_t i = 0; i < ramp_size; ++i) {
-		double val = (double)i / (ramp_size - 1);
-		r[i] = (uint16_t)(UINT16_MAX * pow(val * rw, 1.0 / gamma));
-		g[i] = (uint16_t)(UINT16_MAX * pow(val * gw, 1.0 / gamma));
-		b[i] = (uint16_t)(UINT16_MAX * pow(val * bw, 1.0 / gamma));
+// Stages a table acquired for the output, taking over its reference
+static void output_prepare(struct output *output, struct gamma_table *table) {
+	// Nearby whitepoints often quantize to the same table, especially
+	// with small ramps. The compositor already has it in that case. The
+	// hash rules out most changes, the content settles it.
+	bool unchanged = output->gamma_table != NULL &&
+		output->gamma_table->hash == table->hash &&
+		output->gamma_table->size == table->size &&
+		(output->gamma_table == table ||
+		memcmp(output->gamma_table->data, table->data, table->size) == 0);
+	gamma_table_put(output->gamma_table);
+	output->gamma_table = table;
+	if (unchanged && !output->dirty) {
+		output->stats.gamma_sets_suppressed++;
+		return;
+	}
+
+	// Outputs with the same ramp size share the computed table, but each
+	// needs its own file as the compositor reads from the file offset.
+	output->dirty = false;
+	struct gamma_buffer *buffer = &output->buffers[output->next_buffer];
+	output->next_buffer = (output->next_buffer + 1) % GAMMA_BUFFERS;
+	memcpy(buffer->data, table->data, table->size);
+	lseek(buffer->fd, 0, SEEK_SET);
+	output->pending_buffer = buffer;
+}
+
+static void output_send(struct output *output, int64_t now) {
+	zwlr_gamma_control_v1_set_gamma(output->gamma_control, output->pending_buffer->fd);
+	output->pending_buffer = NULL;
+	trace_event(TRACE_SET_GAMMA, output->id, output->gamma_table->size);
+	if (output->stats.gamma_sets == 0) {
+		output->stats.first_gamma_us = (now - output->added) / 1000;
+		log_info("output %s (%d): first gamma table after %.3f ms, %.3f ms since startup",
+				output->name, output->id, (now - output->added) / 1e6,
+				(now - stats.start_time) / 1e6);
 	}
+	output->stats.gamma_sets++;
+	output->stats.gamma_bytes += output->gamma_table->size;
 }
 
-static void output_set_whitepoint(struct output *output, struct rgb *wp, double gamma) {
-	if (!output->enabled || output->gamma_control == NULL || output->table_fd == -1) {
-		return;
+static int display_flush(struct context *ctx) {
+	int flushed = wl_display_flush(ctx->display);
+	if (flushed > 0) {
+		trace_event(TRACE_FLUSH, 0, flushed);
 	}
-	fill_gamma_table(output->table, output->ramp_size, wp->r, wp->g, wp->b, gamma);
-	lseek(output->table_fd, 0, SEEK_SET);
-	zwlr_gamma_control_v1_set_gamma(output->gamma_control,
-			output->table_fd);
+	return flushed;
 }
 
-static void set_temperature(struct wl_list *outputs, int temp, double gamma) {
-	struct rgb wp = calc_whitepoint(temp);
+/*
+ * Sends every staged table back to back and flushes them in one go, so that
+ * the outputs change together. Anything the socket does not take right away
+ * is flushed by the main loop.
+ */
+static void commit_outputs(struct context *ctx) {
+	int64_t first = 0, last = 0;
+	size_t sent = 0;
 	struct output *output;
-	fprintf(stderr, "setting temperature to %d K\n", temp);
-
-	wl_list_for_each(output, outputs, link) {
-		if (!output->enabled) {
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (output->pending_buffer == NULL) {
 			continue;
 		}
-		if (output->gamma_control == NULL) {
-			setup_gamma_control(output->context, output);
-			continue;
+		last = stats_clock();
+		if (sent++ == 0) {
+			first = last;
 		}
-		output_set_whitepoint(output, &wp, gamma);
+		output_send(output, last);
+	}
+	if (sent == 0) {
+		return;
 	}
+	if (sent > 1) {
+		histogram_add(&stats.commit_spread, last - first);
+	}
+	display_flush(ctx);
 }
 
-static int timer_fired = 0;
-static int usr1_fired = 0;
-static int signal_fds[2];
+static bool output_ready(const struct output *output) {
+	return output->enabled && output->gamma_control != NULL && output->curve != NULL;
+}
 
-static int display_dispatch(struct wl_display *display, int timeout) {
-	if (wl_display_prepare_read(display) == -1) {
-		return wl_display_dispatch_pending(display);
+static void output_prepare_whitepoint(struct output *output, struct rgb *wp) {
+	if (!output_ready(output)) {
+		return;
 	}
+	struct gamma_table *table = gamma_table_get(output->curve, wp);
+	if (table == NULL) {
+		log_error("could not fill gamma table for output %s (%d)",
+				output->name, output->id);
+		return;
+	}
+	output_prepare(output, table);
+}
 
-	struct pollfd pfd[2];
-	pfd[0].fd = wl_display_get_fd(display);
-	pfd[1].fd = signal_fds[0];
-
-	pfd[0].events = POLLOUT;
-	// If we hit EPIPE we might have hit a protocol error. Continue reading
-	// so that we can see what happened.
-	while (wl_display_flush(display) == -1 && errno != EPIPE) {
-		if (errno != EAGAIN) {
-			wl_display_cancel_read(display);
-			return -1;
-		}
+static bool same_whitepoint(const struct rgb *a, const struct rgb *b) {
+	return a->r == b->r && a->g == b->g && a->b == b->b;
+}
 
-		// We only poll the wayland fd here
-		while (poll(pfd, 1, timeout) == -1) {
-			if (errno != EINTR) {
-				wl_display_cancel_read(display);
-				return -1;
-			}
+/*
+ * Applies the position to every profile. The work is per profile
+ * rather than per output: outputs sharing a ramp size, gamma and temperature
+ * share a table, which is only filled once.
+ */
+static bool set_temperature(struct context *ctx, double pos, bool force) {
+	// Before touching any profile, so that a failure leaves the update to
+	// be retried rather than recorded as applied
+	if (ctx->fill_jobs_len < ctx->output_map.count) {
+		struct gamma_table **jobs = realloc(ctx->fill_jobs,
+			ctx->output_map.count * sizeof(struct gamma_table *));
+		if (jobs == NULL) {
+			log_error("could not allocate gamma table jobs");
+			return false;
 		}
+		ctx->fill_jobs = jobs;
+		ctx->fill_jobs_len = ctx->output_map.count;
 	}
 
-	pfd[0].events = POLLIN;
-	pfd[1].events = POLLIN;
-	while (poll(pfd, 2, timeout) == -1) {
-		if (errno != EINTR) {
-			wl_display_cancel_read(display);
-			return -1;
+	bool temp_changed = false, wp_changed = false;
+	for (size_t idx = 0; idx < ctx->config.profiles_len; idx++) {
+		struct profile *profile = &ctx->config.profiles[idx];
+		// Unused profiles are kept current too, for outputs plugged in later
+		profile->changed = false;
+		int temp = get_temp_from_pos(ctx, profile, pos);
+		if (temp == profile->temp && !force) {
+			continue;
 		}
-	}
+		profile->temp = temp;
+		temp_changed = true;
 
-	if (pfd[1].revents & POLLIN) {
-		// Empty signal fd
-		int signal;
-		int res = read(signal_fds[0], &signal, sizeof signal);
-		if (res == -1) {
-			if (errno != EAGAIN) {
-				return -1;
-			}
-		} else if (res != 4) {
-			fprintf(stderr, "could not read full signal ID\n");
-			return -1;
+		struct rgb wp = lookup_whitepoint(temp);
+		if (!force && same_whitepoint(&wp, &profile->wp)) {
+			continue;
 		}
-
-		switch (signal) {
-		case SIGALRM:
-			timer_fired = true;
-			break;
-		case SIGUSR1:
-			// do something
-			usr1_fired = true;
-			break;
+		profile->wp = wp;
+		profile->changed = true;
+		wp_changed = true;
+		trace_event(TRACE_WHITEPOINT, idx, temp);
+		if (ctx->simulation) {
+			// The trace has it
+		} else if (profile->pattern == NULL) {
+			log_debug("setting temperature to %d K", temp);
+		} else if (profile->users > 0) {
+			log_debug("setting temperature of profile %s to %d K",
+					profile->pattern, temp);
 		}
 	}
-
-	if ((pfd[0].revents & POLLIN) == 0) {
-		wl_display_cancel_read(display);
-		return 0;
+	if (!temp_changed) {
+		stats.temperature_suppressed++;
+		return false;
+	}
+	if (!wp_changed) {
+		// Temperatures outside the whitepoint range are clamped
+		stats.whitepoint_suppressed++;
+		return false;
 	}
 
-	if (wl_display_read_events(display) == -1) {
-		return -1;
+	struct output *output;
+	stats.temperature_updates++;
+
+	// Acquire every table first so that the new ones can be filled together
+	size_t jobs = 0;
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (!output->enabled) {
+			continue;
+		}
+		if (output->gamma_control == NULL) {
+			setup_gamma_control(output->context, output);
+			continue;
+		}
+		if (!output_ready(output) || !output->profile->changed) {
+			continue;
+		}
+		bool needs_fill;
+		output->pending_table = gamma_table_acquire(output->curve,
+			&output->profile->wp, &needs_fill);
+		if (output->pending_table == NULL) {
+			log_error("could not fill gamma table for output %s (%d)",
+					output->name, output->id);
+		} else if (needs_fill) {
+			ctx->fill_jobs[jobs++] = output->pending_table;
+		}
 	}
 
-	return wl_display_dispatch_pending(display);
+	int64_t fill_start = stats_clock();
+	fill_pool_run(&ctx->fill_pool, ctx->fill_jobs, jobs);
+	stats.table_fills += jobs;
+	stats.table_fill_ns += stats_clock() - fill_start;
+
+	// Protocol requests stay on the main thread, sent once every table is
+	// ready so that slow fills do not hold back some of the outputs
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (output->pending_table != NULL) {
+			output_prepare(output, output->pending_table);
+			output->pending_table = NULL;
+		}
+	}
+	commit_outputs(ctx);
+	return true;
 }
 
-static void signal_handler(int signal) {
-	if (write(signal_fds[1], &signal, sizeof signal) == -1 && errno != EAGAIN) {
-		// This is unfortunate.
+// Snapshots are only picked up by instances started with the same settings,
+// on the same display
+static uint64_t config_hash(const struct config *config) {
+	uint64_t hash = FNV1A_INIT;
+	hash = fnv1a(hash, &config->longitude, sizeof config->longitude);
+	hash = fnv1a(hash, &config->latitude, sizeof config->latitude);
+	hash = fnv1a(hash, &config->manual_time, sizeof config->manual_time);
+	hash = fnv1a(hash, &config->sunrise, sizeof config->sunrise);
+	hash = fnv1a(hash, &config->sunset, sizeof config->sunset);
+	hash = fnv1a(hash, &config->duration, sizeof config->duration);
+	hash = fnv1a(hash, &config->elevation_twilight, sizeof config->elevation_twilight);
+	hash = fnv1a(hash, &config->elevation_daylight, sizeof config->elevation_daylight);
+	for (size_t idx = 0; idx < config->profiles_len; idx++) {
+		const struct profile *profile = &config->profiles[idx];
+		if (profile->pattern != NULL) {
+			hash = fnv1a(hash, profile->pattern, strlen(profile->pattern) + 1);
+		}
+		hash = fnv1a(hash, &profile->low_temp, sizeof profile->low_temp);
+		hash = fnv1a(hash, &profile->high_temp, sizeof profile->high_temp);
+		hash = fnv1a(hash, &profile->gamma, sizeof profile->gamma);
+	}
+	for (size_t idx = 0; idx < config->output_names.len; idx++) {
+		const char *name = config->output_names.data[idx];
+		hash = fnv1a(hash, name, strlen(name) + 1);
+	}
+	const char *display = getenv("WAYLAND_DISPLAY");
+	if (display != NULL) {
+		hash = fnv1a(hash, display, strlen(display) + 1);
 	}
+	return hash;
 }
 
-static int set_nonblock(int fd) {
-	int flags;
-	if ((flags = fcntl(fd, F_GETFL)) == -1 ||
-			fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-		return -1;
+// Only touches the file when something changed, most updates do not
+static void save_snapshot(struct context *ctx) {
+	struct snapshot_header *header = ctx->snapshot.header;
+	if (header == NULL) {
+		return;
+	}
+	// Forcing is temporary, a restart goes back to the last natural state
+	if (ctx->forced_state != FORCE_OFF) {
+		return;
+	}
+	struct snapshot_header next = *header;
+	next.calc_day = ctx->calc_day;
+	next.dawn = ctx->sun.dawn;
+	next.sunrise = ctx->sun.sunrise;
+	next.sunset = ctx->sun.sunset;
+	next.night = ctx->sun.night;
+	next.state = ctx->state;
+	next.condition = ctx->condition;
+	next.gamma = ctx->config.gamma;
+	if (memcmp(&next, header, sizeof next) != 0) {
+		*header = next;
+		snapshot_commit(&ctx->snapshot);
 	}
-	return 0;
 }
 
-static int setup_signals(struct context *ctx) {
-	struct sigaction signal_action = {
-		.sa_handler = signal_handler,
-		.sa_flags = 0,
-	};
-	if (pipe(signal_fds) == -1) {
-		fprintf(stderr, "could not create signal pipe: %s\n",
-				strerror(errno));
-		return -1;
+/*
+ * Picks up the trajectory of an earlier instance, so that outputs can be set
+ * up before anything expensive is calculated. Whitepoints come from the
+ * trajectory at the current time, so a snapshot from a different day is of
+ * no use and a cold start follows instead.
+ */
+static bool restore_snapshot(struct context *ctx) {
+	const struct snapshot_header *header = ctx->snapshot.header;
+	if (header == NULL || !ctx->snapshot.valid) {
+		return false;
 	}
-	if (set_nonblock(signal_fds[0]) == -1 ||
-			set_nonblock(signal_fds[1]) == -1) {
-		fprintf(stderr, "could not set nonblock on signal pipe: %s\n",
-				strerror(errno));
-		return -1;
+	int64_t now = get_time_ns();
+	if (header->calc_day != round_day_offset(now / NSEC_PER_SEC,
+			ctx->longitude_time_offset)) {
+		return false;
 	}
-	if (sigaction(SIGALRM, &signal_action, NULL) == -1) {
-		fprintf(stderr, "could not configure SIGALRM handler: %s\n",
-				strerror(errno));
-		return -1;
+	bool usable = header->condition >= 0 && header->condition < SUN_CONDITION_LAST &&
+		(header->state == STATE_NORMAL || header->state == STATE_STATIC ||
+		(header->state == STATE_TRANSITION && header->condition == MIDNIGHT_SUN));
+	if (!usable) {
+		return false;
 	}
-	if (sigaction(SIGUSR1, &signal_action, NULL) == -1) {
-		fprintf(stderr, "could not configure SIGUSR1 handler: %s\n",
-				strerror(errno));
-		return -1;
+
+	if (header->gamma != ctx->config.gamma) {
+		for (size_t idx = 0; idx < ctx->config.profiles_len; idx++) {
+			ctx->config.profiles[idx].gamma = header->gamma;
+		}
+		ctx->config.gamma = header->gamma;
 	}
-	if (timer_create(CLOCK_REALTIME, NULL, &ctx->timer) == -1) {
-		fprintf(stderr, "could not configure timer: %s\n",
-				strerror(errno));
-		return -1;
+	ctx->calc_day = header->calc_day;
+	ctx->sun = (struct sun){
+		.dawn = header->dawn,
+		.sunrise = header->sunrise,
+		.sunset = header->sunset,
+		.night = header->night,
+	};
+	ctx->state = header->state;
+	ctx->condition = header->condition;
+	ctx->pos = get_position(ctx, now);
+	for (size_t idx = 0; idx < ctx->config.profiles_len; idx++) {
+		struct profile *profile = &ctx->config.profiles[idx];
+		profile->temp = get_temp_from_pos(ctx, profile, ctx->pos);
+		profile->wp = lookup_whitepoint(profile->temp);
 	}
-	return 0;
+	log_info("restored trajectory from snapshot, starting at %d K",
+		ctx->config.profiles[0].temp);
+	return true;
 }
 
-static int wlrun(struct config cfg) {
-	// Initialize defaults
+static bool update(struct context *ctx, bool force) {
+	if (ctx->warm_pending) {
+		// finish_warm_start() catches up with whatever changed meanwhile
+		return false;
+	}
+	int64_t now = get_time_ns();
+	if (ctx->config.manual_time) {
+		time_t offset = -get_timezone(now / NSEC_PER_SEC);
+		if (offset != ctx->longitude_time_offset) {
+			ctx->longitude_time_offset = offset;
+			ctx->calc_day = 0;
+		}
+	}
+	recalc_stops(ctx, now / NSEC_PER_SEC);
+
+	if (ctx->paused) {
+		// Hold the current temperature, only new outputs need it applied.
+		// Forcing still takes effect, it does not depend on the time.
+		disarm_timer(ctx, ctx->timer_source.fd);
+		if (force) {
+			if (ctx->state == STATE_FORCED) {
+				ctx->pos = get_position(ctx, now);
+			}
+			set_temperature(ctx, ctx->pos, true);
+		}
+		return force;
+	}
+	update_timer(ctx, ctx->timer_source.fd, now);
+
+	double pos = get_position(ctx, now);
+	if (pos == ctx->pos && !force) {
+		return false;
+	}
+	ctx->pos = pos;
+	bool updated = set_temperature(ctx, pos, force);
+	save_snapshot(ctx);
+	return updated;
+}
+
+// Bring outputs that were just (re)configured up to date, leaving the rest alone
+static void update_dirty_outputs(struct context *ctx) {
+	ctx->outputs_dirty = false;
+	struct output *output;
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (output->dirty && output->enabled) {
+			output_prepare_whitepoint(output, &output->profile->wp);
+		}
+	}
+	commit_outputs(ctx);
+}
+
+// Outputs that asked for gamma control and have not been told their size yet
+static bool outputs_waiting(struct context *ctx) {
+	struct output *output;
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (output->enabled && output->gamma_control != NULL &&
+				output->curve == NULL) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int load_ephemeris(struct context *ctx) {
+	const struct config *cfg = &ctx->config;
+	if (cfg->manual_time) {
+		return 0;
+	}
+	if (ephemeris_load(&ctx->ephemeris, cfg->latitude,
+			cfg->elevation_twilight, cfg->elevation_daylight) == -1) {
+		log_error("could not compute sun trajectory");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Once outputs have the restored whitepoints, calculate the actual ones.
+ * Tables that did not change are not sent again.
+ */
+static int finish_warm_start(struct context *ctx) {
+	ctx->warm_pending = false;
+	if (load_ephemeris(ctx) == -1) {
+		return -1;
+	}
+	update(ctx, true);
+	return 0;
+}
+
+static int set_gamma(struct context *ctx, double gamma) {
+	struct output *output;
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (output->curve == NULL) {
+			continue;
+		}
+		struct gamma_curve *curve = gamma_curve_get(output->ramp_size, gamma);
+		if (curve == NULL) {
+			return -1;
+		}
+		gamma_table_put(output->gamma_table);
+		output->gamma_table = NULL;
+		gamma_curve_put(output->curve);
+		output->curve = curve;
+	}
+	// Applies to every output, overriding the gamma of profiles
+	for (size_t idx = 0; idx < ctx->config.profiles_len; idx++) {
+		ctx->config.profiles[idx].gamma = gamma;
+	}
+	ctx->config.gamma = gamma;
+	update(ctx, true);
+	return 0;
+}
+
+static void set_forced_state(struct context *ctx, enum force_state state) {
+	ctx->forced_state = state;
+	// Force re-calculation
+	ctx->calc_day = 0;
+	update(ctx, true);
+}
+
+static int handle_display(void *data, uint32_t events) {
+	struct context *ctx = data;
+	ctx->display_events = events;
+	return 0;
+}
+
+static int handle_timer(void *data, uint32_t events) {
+	(void)events;
+	struct context *ctx = data;
+	uint64_t expirations;
+	if (read(ctx->timer_source.fd, &expirations, sizeof expirations) == -1) {
+		if (errno == ECANCELED) {
+			log_info("clock changed, recalculating");
+			stats.clock_changes++;
+			ctx->calc_day = 0;
+			update(ctx, false);
+			return 0;
+		} else if (errno != EAGAIN) {
+			log_error("could not read timer: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	int64_t deadline = ctx->timer_deadline;
+	int64_t jitter = get_real_time_ns() - deadline;
+	stats.timer_wakeups++;
+	histogram_add(&stats.timer_jitter, jitter);
+	trace_event(TRACE_TIMER_FIRE, 0, jitter);
+	if (update(ctx, false)) {
+		histogram_add(&stats.update_latency, get_real_time_ns() - deadline);
+	}
+	return 0;
+}
+
+static void print_stats(struct context *ctx, FILE *f) {
+	stats_print(f);
+	struct output *output;
+	wl_list_for_each(output, &ctx->outputs, link) {
+		stats_print_output(f, output->name != NULL ? output->name : "",
+			output->id, &output->stats);
+	}
+}
+
+static void write_stats(struct context *ctx) {
+	if (ctx->stats_path == NULL) {
+		log_flush();
+		print_stats(ctx, stderr);
+		return;
+	}
+
+	// Write to a temporary file first so that readers never see a partial dump
+	char tmp_path[PATH_MAX];
+	snprintf(tmp_path, sizeof tmp_path, "%s.tmp", ctx->stats_path);
+	FILE *f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		log_error("could not write stats to %s: %s",
+				tmp_path, strerror(errno));
+		return;
+	}
+	print_stats(ctx, f);
+	if (fclose(f) != 0 || rename(tmp_path, ctx->stats_path) == -1) {
+		log_error("could not write stats to %s: %s",
+				ctx->stats_path, strerror(errno));
+		unlink(tmp_path);
+	}
+}
+
+static char *get_runtime_path(const char *suffix) {
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (runtime_dir == NULL || runtime_dir[0] == '\0') {
+		return NULL;
+	}
+	char path[PATH_MAX];
+	int len = snprintf(path, sizeof path, "%s/wlsunset-%d.%s",
+		runtime_dir, (int)getpid(), suffix);
+	if (len < 0 || (size_t)len >= sizeof path - strlen(".tmp")) {
+		return NULL;
+	}
+	return strdup(path);
+}
+
+static const char *state_names[] = {
+	[STATE_INITIAL] = "initial",
+	[STATE_NORMAL] = "normal",
+	[STATE_TRANSITION] = "transition",
+	[STATE_STATIC] = "static",
+	[STATE_FORCED] = "forced",
+};
+
+static const char *force_state_names[] = {
+	[FORCE_OFF] = "off",
+	[FORCE_HIGH] = "high",
+	[FORCE_LOW] = "low",
+	[FORCE_TEMP] = "temperature",
+};
+
+static void handle_command(void *data, char *line, FILE *reply) {
+	struct context *ctx = data;
+	char *saveptr = NULL;
+	char *cmd = strtok_r(line, " \t", &saveptr);
+	char *arg = strtok_r(NULL, " \t", &saveptr);
+	char *end = NULL;
+	if (cmd == NULL) {
+		return;
+	}
+
+	if (strcmp(cmd, "query") == 0) {
+		// Answered from the last update, nothing is recalculated here
+		fprintf(reply, "state=%s forced=%s paused=%s pos=%.6f temp=%d gamma=%.3f",
+			state_names[ctx->state], force_state_names[ctx->forced_state],
+			ctx->paused ? "yes" : "no", ctx->pos, ctx->config.profiles[0].temp,
+			ctx->config.gamma);
+		if (ctx->timer_deadline != 0) {
+			fprintf(reply, " deadline=%lld.%09lld\n",
+				(long long)(ctx->timer_deadline / NSEC_PER_SEC),
+				(long long)(ctx->timer_deadline % NSEC_PER_SEC));
+		} else {
+			fprintf(reply, " deadline=none\n");
+		}
+	} else if (strcmp(cmd, "stats") == 0) {
+		print_stats(ctx, reply);
+	} else if (strcmp(cmd, "trace") == 0 && arg != NULL) {
+		if (trace_write(arg) == -1) {
+			fprintf(reply, "error could not write trace: %s\n", strerror(errno));
+			return;
+		}
+		fprintf(reply, "ok\n");
+	} else if (strcmp(cmd, "temperature") == 0 && arg != NULL) {
+		long temp = strtol(arg, &end, 10);
+		if (*end != '\0' || temp <= 0 || temp > 100000) {
+			fprintf(reply, "error invalid temperature: %s\n", arg);
+			return;
+		}
+		ctx->forced_temp = temp;
+		set_forced_state(ctx, FORCE_TEMP);
+		fprintf(reply, "ok\n");
+	} else if (strcmp(cmd, "gamma") == 0 && arg != NULL) {
+		double gamma = strtod(arg, &end);
+		if (*end != '\0' || !(gamma > 0.0)) {
+			fprintf(reply, "error invalid gamma: %s\n", arg);
+			return;
+		}
+		if (set_gamma(ctx, gamma) == -1) {
+			fprintf(reply, "error could not create gamma tables\n");
+			return;
+		}
+		fprintf(reply, "ok\n");
+	} else if (strcmp(cmd, "force") == 0 && arg != NULL) {
+		if (strcmp(arg, "high") == 0) {
+			set_forced_state(ctx, FORCE_HIGH);
+		} else if (strcmp(arg, "low") == 0) {
+			set_forced_state(ctx, FORCE_LOW);
+		} else if (strcmp(arg, "off") == 0) {
+			set_forced_state(ctx, FORCE_OFF);
+		} else {
+			fprintf(reply, "error invalid force state: %s\n", arg);
+			return;
+		}
+		fprintf(reply, "ok\n");
+	} else if (strcmp(cmd, "pause") == 0) {
+		ctx->paused = true;
+		update(ctx, false);
+		fprintf(reply, "ok\n");
+	} else if (strcmp(cmd, "resume") == 0) {
+		ctx->paused = false;
+		update(ctx, true);
+		fprintf(reply, "ok\n");
+	} else {
+		fprintf(reply, "error unknown command: %s\n", cmd);
+	}
+}
+
+static int handle_signal(void *data, uint32_t events) {
+	(void)events;
+	struct context *ctx = data;
+	struct signalfd_siginfo info;
+	ssize_t res = read(ctx->signal_source.fd, &info, sizeof info);
+	if (res == -1) {
+		return errno == EAGAIN ? 0 : -1;
+	} else if (res != sizeof info) {
+		log_error("could not read full signal info");
+		return -1;
+	}
+
+	switch (info.ssi_signo) {
+	case SIGUSR1:
+		switch (ctx->forced_state) {
+		case FORCE_OFF:
+			log_info("forcing high temperature");
+			set_forced_state(ctx, FORCE_HIGH);
+			break;
+		case FORCE_HIGH:
+			log_info("forcing low temperature");
+			set_forced_state(ctx, FORCE_LOW);
+			break;
+		case FORCE_LOW:
+		case FORCE_TEMP:
+			log_info("disabling forced temperature");
+			set_forced_state(ctx, FORCE_OFF);
+			break;
+		default:
+			abort();
+		}
+		break;
+	case SIGUSR2:
+		write_stats(ctx);
+		if (ctx->trace_path != NULL && trace_write(ctx->trace_path) == -1) {
+			log_error("could not write trace to %s: %s",
+					ctx->trace_path, strerror(errno));
+		}
+		break;
+	case SIGINT:
+	case SIGTERM:
+		ctx->running = false;
+		break;
+	}
+	return 0;
+}
+
+static int display_dispatch(struct context *ctx) {
+	struct wl_display *display = ctx->display;
+	if (wl_display_prepare_read(display) == -1) {
+		return wl_display_dispatch_pending(display);
+	}
+
+	// If we hit EPIPE we might have hit a protocol error. Continue reading
+	// so that we can see what happened.
+	uint32_t events = EPOLLIN;
+	int flushed = display_flush(ctx);
+	if (flushed == -1 && errno != EPIPE) {
+		if (errno != EAGAIN) {
+			wl_display_cancel_read(display);
+			return -1;
+		}
+		// Wait until we can write the rest
+		events |= EPOLLOUT;
+	}
+	if (events != ctx->display_source.events &&
+			event_loop_update(&ctx->loop, &ctx->display_source, events) == -1) {
+		wl_display_cancel_read(display);
+		return -1;
+	}
+
+	ctx->display_events = 0;
+	if (event_loop_dispatch(&ctx->loop, -1) == -1) {
+		wl_display_cancel_read(display);
+		return -1;
+	}
+
+	if ((ctx->display_events & (EPOLLIN | EPOLLERR | EPOLLHUP)) == 0) {
+		wl_display_cancel_read(display);
+		return 0;
+	}
+
+	if (wl_display_read_events(display) == -1) {
+		return -1;
+	}
+
+	return wl_display_dispatch_pending(display);
+}
+
+static void close_source(struct event_source *source) {
+	if (source->fd != -1) {
+		close(source->fd);
+		source->fd = -1;
+	}
+}
+
+static int setup_timer(struct context *ctx) {
+	int fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd == -1) {
+		log_error("could not create timer: %s", strerror(errno));
+		return -1;
+	}
+	ctx->timer_source = (struct event_source) {
+		.fd = fd,
+		.events = EPOLLIN,
+		.handler = handle_timer,
+		.data = ctx,
+	};
+	if (event_loop_add(&ctx->loop, &ctx->timer_source) == -1) {
+		log_error("could not add timer to event loop: %s",
+				strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+#if defined(HAVE_INOTIFY)
+static int handle_timezone(void *data, uint32_t events) {
+	(void)events;
+	struct context *ctx = data;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+	ssize_t len;
+	while ((len = read(ctx->tz_source.fd, buf, sizeof buf)) > 0) {
+		for (char *ptr = buf; ptr < buf + len;) {
+			struct inotify_event *event = (struct inotify_event *)ptr;
+			if (event->len > 0 && strcmp(event->name, "localtime") == 0) {
+				changed = true;
+			}
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	if (!changed) {
+		return 0;
+	}
+
+	log_info("timezone changed, recalculating");
+	stats.timezone_changes++;
+	tzset();
+	ctx->calc_day = 0;
+	update(ctx, false);
+	return 0;
+}
+
+static void setup_timezone_watch(struct context *ctx) {
+	// /etc/localtime is usually a symlink that gets replaced, so watch /etc
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd == -1) {
+		return;
+	}
+	if (inotify_add_watch(fd, "/etc", IN_CREATE | IN_MOVED_TO |
+			IN_CLOSE_WRITE | IN_DELETE) == -1) {
+		close(fd);
+		return;
+	}
+	ctx->tz_source = (struct event_source) {
+		.fd = fd,
+		.events = EPOLLIN,
+		.handler = handle_timezone,
+		.data = ctx,
+	};
+	if (event_loop_add(&ctx->loop, &ctx->tz_source) == -1) {
+		close(fd);
+		ctx->tz_source.fd = -1;
+	}
+}
+#else
+static void setup_timezone_watch(struct context *ctx) {
+	(void)ctx;
+}
+#endif
+
+static int setup_signals(struct context *ctx) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+		log_error("could not block signals: %s", strerror(errno));
+		return -1;
+	}
+
+	int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd == -1) {
+		log_error("could not create signalfd: %s", strerror(errno));
+		return -1;
+	}
+	ctx->signal_source = (struct event_source) {
+		.fd = fd,
+		.events = EPOLLIN,
+		.handler = handle_signal,
+		.data = ctx,
+	};
+	if (event_loop_add(&ctx->loop, &ctx->signal_source) == -1) {
+		log_error("could not add signalfd to event loop: %s",
+				strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Runs the state machine against a virtual clock, jumping straight from one
+ * timer deadline to the next. Every wakeup is traced to stdout as the local
+ * time, state and temperature, with a * where the gamma would be set.
+ */
+static int simulate(struct config cfg) {
 	struct context ctx = {
 		.sun = { 0 },
 		.condition = SUN_CONDITION_LAST,
 		.state = STATE_INITIAL,
 		.config = cfg,
+		.pos = -1.0,
+		.min_step_time = NSEC_PER_SEC / cfg.max_rate,
+		.simulation = true,
+		.timer_source = { .fd = -1 },
 	};
+	wl_list_init(&ctx.outputs);
+	// A year of trajectory lines comes out in well under a second
+	log_set_rate_limit(false);
 
+	int64_t now = sec_to_ns(cfg.simulation_start);
+	int64_t end = now + sec_to_ns((time_t)cfg.simulation_days * 86400);
+	virtual_time = now;
 	if (!cfg.manual_time) {
 		ctx.longitude_time_offset = longitude_time_offset(cfg.longitude);
 	} else {
-		ctx.longitude_time_offset = -get_timezone();
+		ctx.longitude_time_offset = -get_timezone(now / NSEC_PER_SEC);
+	}
+	if (load_ephemeris(&ctx) == -1) {
+		return EXIT_FAILURE;
+	}
+
+	int64_t began = stats_clock();
+	bool force = true;
+	while (virtual_time < end) {
+		bool updated = update(&ctx, force);
+		force = false;
+		stats.timer_wakeups++;
+
+		time_t sec = virtual_time / NSEC_PER_SEC;
+		struct tm tm;
+		localtime_r(&sec, &tm);
+		printf("%04d-%02d-%02d %02d:%02d:%02d.%03d %s %d%s\n",
+			tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+			tm.tm_hour, tm.tm_min, tm.tm_sec,
+			(int)(virtual_time % NSEC_PER_SEC / 1000000),
+			state_names[ctx.state], ctx.config.profiles[0].temp,
+			updated ? " *" : "");
+		virtual_time = ctx.timer_deadline;
 	}
 
+	// Trajectory lines are still buffered, they come first
+	log_flush();
+	fprintf(stderr, "simulated %d days in %.3f ms: %llu wakeups, %llu temperature updates\n",
+		cfg.simulation_days, (stats_clock() - began) / 1e6,
+		(unsigned long long)stats.timer_wakeups,
+		(unsigned long long)stats.temperature_updates);
+	ephemeris_finish(&ctx.ephemeris);
+	return EXIT_SUCCESS;
+}
+
+static int wlrun(struct config cfg) {
+	// Initialize defaults
+	struct context ctx = {
+		.sun = { 0 },
+		.condition = SUN_CONDITION_LAST,
+		.state = STATE_INITIAL,
+		.config = cfg,
+		.pos = -1.0,
+		.min_step_time = NSEC_PER_SEC / cfg.max_rate,
+		.running = true,
+		.timer_source = { .fd = -1 },
+		.signal_source = { .fd = -1 },
+		.tz_source = { .fd = -1 },
+	};
+
 	wl_list_init(&ctx.outputs);
+	if (name_matcher_init(&ctx.output_matcher, &cfg.output_names) == -1) {
+		log_error("could not allocate output matcher");
+		return EXIT_FAILURE;
+	}
 
-	if (setup_signals(&ctx) == -1) {
+	if (event_loop_init(&ctx.loop) == -1) {
+		log_error("could not create event loop: %s", strerror(errno));
 		return EXIT_FAILURE;
 	}
+	if (setup_timer(&ctx) == -1 || setup_signals(&ctx) == -1) {
+		return EXIT_FAILURE;
+	}
+	setup_timezone_watch(&ctx);
+	// Workers inherit the signal mask, so they must be started afterwards
+	if (fill_pool_init(&ctx.fill_pool, cfg.threads) == -1) {
+		log_error("could not start %d worker threads", cfg.threads);
+		return EXIT_FAILURE;
+	}
+
+	if (!cfg.manual_time) {
+		ctx.longitude_time_offset = longitude_time_offset(cfg.longitude);
+	} else {
+		ctx.longitude_time_offset = -get_timezone(get_time_ns() / NSEC_PER_SEC);
+	}
+	// Without a snapshot, start out unadjusted as before
+	bool warm = snapshot_open(&ctx.snapshot, config_hash(&cfg)) == 0 &&
+		restore_snapshot(&ctx);
 
-	struct wl_display *display = wl_display_connect(NULL);
-	if (display == NULL) {
-		fprintf(stderr, "failed to create display\n");
+	ctx.display = wl_display_connect(NULL);
+	if (ctx.display == NULL) {
+		log_error("failed to create display");
 		return EXIT_FAILURE;
 	}
 
-	struct wl_registry *registry = wl_display_get_registry(display);
+	// Get the registry request out first, and work out the sun trajectory
+	// and whitepoints while the compositor answers
+	struct wl_registry *registry = wl_display_get_registry(ctx.display);
 	wl_registry_add_listener(registry, &registry_listener, &ctx);
-	wl_display_roundtrip(display);
+	wl_display_flush(ctx.display);
+
+	// A restored snapshot already has the whitepoints, so the calculation
+	// can wait until outputs have their first tables
+	if (!warm) {
+		if (load_ephemeris(&ctx) == -1) {
+			return EXIT_FAILURE;
+		}
+		// There are no outputs yet, this only prepares the whitepoints
+		update(&ctx, true);
+	}
+
+	wl_display_roundtrip(ctx.display);
 
 	if (ctx.gamma_control_manager == NULL) {
-		fprintf(stderr, "compositor doesn't support wlr-gamma-control-unstable-v1\n");
+		log_error("compositor doesn't support wlr-gamma-control-unstable-v1");
 		return EXIT_FAILURE;
 	}
 
+	// Outputs are not waited for, each gets its table from the main loop
+	// as soon as its gamma size is known
 	struct output *output;
 	wl_list_for_each(output, &ctx.outputs, link) {
 		if (output->enabled) {
 			setup_gamma_control(&ctx, output);
 		}
 	}
-	wl_display_roundtrip(display);
 
-	time_t now = get_time_sec();
-	recalc_stops(&ctx, now);
-	update_timer(&ctx, ctx.timer, now);
-
-	double pos = get_position(&ctx, now);
-	set_temperature(&ctx.outputs, get_temp_from_pos(&ctx, pos), ctx.config.gamma);
+	ctx.display_source = (struct event_source) {
+		.fd = wl_display_get_fd(ctx.display),
+		.events = EPOLLIN,
+		.handler = handle_display,
+		.data = &ctx,
+	};
+	if (event_loop_add(&ctx.loop, &ctx.display_source) == -1) {
+		log_error("could not add display to event loop: %s",
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
 
-	double old_pos = pos;
-	while (display_dispatch(display, -1) != -1) {
-		if (ctx.new_output) {
-			ctx.new_output = false;
+	ctx.warm_pending = warm;
 
-			// Force set_temperature
-			old_pos = -1.0;
-			timer_fired = true;
-		}
+	ctx.stats_path = get_runtime_path("stats");
+	ctx.trace_path = get_runtime_path("trace");
 
-		if (usr1_fired) {
-			usr1_fired = false;
-			switch (ctx.forced_state) {
-			case FORCE_OFF:
-				ctx.forced_state = FORCE_HIGH;
-				fprintf(stderr, "forcing high temperature\n");
-				break;
-			case FORCE_HIGH:
-				ctx.forced_state = FORCE_LOW;
-				fprintf(stderr, "forcing low temperature\n");
-				break;
-			case FORCE_LOW:
-				ctx.forced_state = FORCE_OFF;
-				fprintf(stderr, "disabling forced temperature\n");
-				break;
-			default:
-				abort();
-			}
+	if (cfg.control_path != NULL && control_init(&ctx.control, &ctx.loop,
+			cfg.control_path, handle_command, &ctx) == -1) {
+		log_error("could not create control socket %s: %s",
+				cfg.control_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
 
-			// Force re-calculation
-			ctx.calc_day = 0;
-			timer_fired = true;
+	// Outputs may already have their gamma size from the roundtrip, so
+	// bring them up to date before waiting for anything
+	int ret = EXIT_SUCCESS;
+	while (ctx.running) {
+		if (ctx.outputs_dirty) {
+			update_dirty_outputs(&ctx);
 		}
-
-		if (timer_fired) {
-			timer_fired = false;
-			now = get_time_sec();
-			recalc_stops(&ctx, now);
-			update_timer(&ctx, ctx.timer, now);
-
-			pos = get_position(&ctx, now);
-			if (pos != old_pos) {
-				old_pos = pos;
-				ctx.new_output = false;
-
-				set_temperature(&ctx.outputs, get_temp_from_pos(&ctx, pos),
-						ctx.config.gamma);
-			}
+		if (ctx.warm_pending && !outputs_waiting(&ctx) &&
+				finish_warm_start(&ctx) == -1) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+		// Buffered log lines go out before blocking, usually there are none
+		log_flush();
+		if (display_dispatch(&ctx) == -1) {
+			break;
 		}
 	}
 
-	return EXIT_SUCCESS;
+	if (cfg.control_path != NULL) {
+		control_finish(&ctx.control);
+	}
+	if (ctx.stats_path != NULL) {
+		unlink(ctx.stats_path);
+		free(ctx.stats_path);
+	}
+	if (ctx.trace_path != NULL) {
+		unlink(ctx.trace_path);
+		free(ctx.trace_path);
+	}
+	snapshot_close(&ctx.snapshot);
+	ephemeris_finish(&ctx.ephemeris);
+	name_matcher_finish(&ctx.output_matcher);
+	fill_pool_finish(&ctx.fill_pool);
+	free(ctx.fill_jobs);
+	close_source(&ctx.tz_source);
+	close_source(&ctx.signal_source);
+	close_source(&ctx.timer_source);
+	event_loop_finish(&ctx.loop);
+	return ret;
 }
 
 static int parse_time_of_day(const char *s, time_t *time) {
@@ -903,10 +2013,91 @@ static int parse_time_of_day(const char *s, time_t *time) {
 	return 0;
 }
 
+// [<YYYY-MM-DD>:]<days>, starting at local midnight or otherwise right now
+static int parse_simulation(const char *s, time_t *start, int *days) {
+	const char *count = s;
+	*start = time(NULL);
+	if (strchr(s, ':') != NULL) {
+		struct tm tm = { .tm_isdst = -1 };
+		count = strptime(s, "%Y-%m-%d", &tm);
+		if (count == NULL || *count != ':') {
+			return -1;
+		}
+		count++;
+		*start = mktime(&tm);
+	}
+	char *end = NULL;
+	long value = strtol(count, &end, 10);
+	if (*end != '\0' || value <= 0 || value > 36600) {
+		return -1;
+	}
+	*days = value;
+	return 0;
+}
+
+// Empty fields are left as zero, to use the global setting
+static int parse_profile_temp(const char *s, int *value) {
+	char *end = NULL;
+	*value = 0;
+	if (*s == '\0') {
+		return 0;
+	}
+	long temp = strtol(s, &end, 10);
+	if (*end != '\0' || temp <= 0 || temp > INT_MAX) {
+		return -1;
+	}
+	*value = temp;
+	return 0;
+}
+
+static int parse_profile_gamma(const char *s, double *value) {
+	char *end = NULL;
+	*value = 0.0;
+	if (*s == '\0') {
+		return 0;
+	}
+	*value = strtod(s, &end);
+	return *end == '\0' && *value > 0.0 ? 0 : -1;
+}
+
+// Splits off the last field of s, returning it
+static char *split_profile_field(char *s) {
+	char *sep = strrchr(s, ':');
+	if (sep == NULL) {
+		return NULL;
+	}
+	*sep = '\0';
+	return sep + 1;
+}
+
+/*
+ * Parses <output>:<low>:<high>:<gamma>, split from the right as output
+ * descriptions may contain colons. Empty fields are left as zero.
+ */
+static int parse_profile(const char *s, struct profile *profile) {
+	char *pattern = strdup(s);
+	if (pattern == NULL) {
+		return -1;
+	}
+	*profile = (struct profile){ .pattern = pattern };
+	char *gamma = split_profile_field(pattern);
+	char *high = gamma != NULL ? split_profile_field(pattern) : NULL;
+	char *low = high != NULL ? split_profile_field(pattern) : NULL;
+	if (low == NULL || *pattern == '\0' ||
+			parse_profile_temp(low, &profile->low_temp) == -1 ||
+			parse_profile_temp(high, &profile->high_temp) == -1 ||
+			parse_profile_gamma(gamma, &profile->gamma) == -1) {
+		free(pattern);
+		profile->pattern = NULL;
+		return -1;
+	}
+	return 0;
+}
+
 static const char usage[] = "usage: %s [options]\n"
 "  -h             show this help message\n"
 "  -v             show the version number\n"
-"  -o <output>    name of output (display) to use,\n"
+"  -o <output>    name or glob of output (display) to use,\n"
 "                 by default all outputs are used\n"
 "                 can be specified multiple times\n"
 "  -t <temp>      set low temperature (default: 4000)\n"
@@ -918,13 +2109,23 @@ static const char usage[] = "usage: %s [options]\n"
 "  -S <sunrise>   set manual sunrise (e.g. 06:30)\n"
 "  -s <sunset>    set manual sunset (e.g. 18:30)\n"
 "  -d <duration>  set manual duration in seconds (e.g. 1800)\n"
-"  -g <gamma>     set gamma (default: 1.0)\n";
+"  -r <rate>      set maximum updates per second during transitions (default: 30)\n"
+"  -u <delta>     set minimum whitepoint change per update in CIE u'v' (default: 0.0005)\n"
+"  -g <gamma>     set gamma (default: 1.0)\n"
+"  -P <output>:<low>:<high>:<gamma>\n"
+"                 set temperatures and gamma for outputs matching a name\n"
+"                 or glob, empty fields use the global settings\n"
+"                 can be specified multiple times\n"
+"  -c <path>      listen for control commands on a unix socket at path\n"
+"  -j <threads>   fill gamma tables on worker threads (default: 0, inline)\n"
+"  -x [<date>:]<days>\n"
+"                 simulate the given number of days without a display,\n"
+"                 from now or from a date (e.g. 2026-01-01:365)\n"
+"  -V <level>     set log level: error, warn, info or debug (default: info)\n";
 
 int main(int argc, char *argv[]) {
-#ifdef SPEEDRUN
-	fprintf(stderr, "warning: speedrun mode enabled\n");
-#endif
-	init_time();
+	stats.start_time = stats_clock();
+	tzset();
 
 	struct config config = {
 		.latitude = NAN,
@@ -934,12 +2135,22 @@ int main(int argc, char *argv[]) {
 		.gamma = 1.0,
 		.elevation_daylight = 3.0,
 		.elevation_twilight = -6.0,
+		.max_rate = 30,
+		.min_change = 0.0005,
 	};
 	str_vec_init(&config.output_names);
 
 	int ret = EXIT_FAILURE;
+	// The first profile is the global one, filled in once all options are known
+	config.profiles = calloc(1, sizeof(struct profile));
+	if (config.profiles == NULL) {
+		fprintf(stderr, "could not allocate profiles\n");
+		goto end;
+	}
+	config.profiles_len = 1;
+
 	int opt;
-	while ((opt = getopt(argc, argv, "hvo:t:T:l:L:S:s:d:g:E:e:")) != -1) {
+	while ((opt = getopt(argc, argv, "hvo:t:T:l:L:S:s:d:r:u:g:P:c:j:x:E:e:V:")) != -1) {
 		switch (opt) {
 			case 'o':
 				str_vec_push(&config.output_names, optarg);
@@ -973,9 +2184,55 @@ int main(int argc, char *argv[]) {
 			case 'd':
 				config.duration = strtol(optarg, NULL, 10);
 				break;
+			case 'r':
+				config.max_rate = strtol(optarg, NULL, 10);
+				break;
+			case 'u':
+				config.min_change = strtod(optarg, NULL);
+				break;
 			case 'g':
 				config.gamma = strtod(optarg, NULL);
 				break;
+			case 'P': {
+				struct profile *profiles = realloc(config.profiles,
+					(config.profiles_len + 1) * sizeof(struct profile));
+				if (profiles == NULL) {
+					fprintf(stderr, "could not allocate profiles\n");
+					goto end;
+				}
+				config.profiles = profiles;
+				if (parse_profile(optarg, &config.profiles[config.profiles_len]) != 0) {
+					fprintf(stderr, "invalid profile, expected <output>:<low>:<high>:<gamma>, got %s\n",
+							optarg);
+					goto end;
+				}
+				config.profiles_len++;
+				break;
+			}
+			case 'c':
+				config.control_path = optarg;
+				break;
+			case 'j':
+				config.threads = strtol(optarg, NULL, 10);
+				break;
+			case 'x':
+				if (parse_simulation(optarg, &config.simulation_start,
+						&config.simulation_days) != 0) {
+					fprintf(stderr, "invalid simulation, expected [YYYY-MM-DD:]<days>, got %s\n",
+							optarg);
+					goto end;
+				}
+				break;
+			case 'V': {
+				enum log_level level;
+				if (log_parse_level(optarg, &level) != 0) {
+					fprintf(stderr, "invalid log level, expected error, warn, info or debug, got %s\n",
+							optarg);
+					goto end;
+				}
+				log_set_level(level);
+				break;
+			}
 			case 'v':
 				printf("wlsunset version %s\n", WLSUNSET_VERSION);
 				ret = EXIT_SUCCESS;
@@ -1005,6 +2262,42 @@ int main(int argc, char *argv[]) {
 				config.high_temp, config.low_temp);
 		goto end;
 	}
+	config.profiles[0] = (struct profile){
+		.low_temp = config.low_temp,
+		.high_temp = config.high_temp,
+		.gamma = config.gamma,
+	};
+	for (size_t idx = 1; idx < config.profiles_len; idx++) {
+		struct profile *profile = &config.profiles[idx];
+		if (profile->low_temp == 0) {
+			profile->low_temp = config.low_temp;
+		}
+		if (profile->high_temp == 0) {
+			profile->high_temp = config.high_temp;
+		}
+		if (profile->gamma == 0.0) {
+			profile->gamma = config.gamma;
+		}
+		if (profile->high_temp <= profile->low_temp) {
+			fprintf(stderr, "high temp (%d) must be higher than low (%d) temp in profile %s\n",
+					profile->high_temp, profile->low_temp, profile->pattern);
+			goto end;
+		}
+	}
+	if (config.threads < 0 || config.threads > 64) {
+		fprintf(stderr, "thread count (%d) must be in interval [0,64]\n",
+				config.threads);
+		goto end;
+	}
+	if (!(config.min_change >= 0.0)) {
+		fprintf(stderr, "whitepoint change (%lf) must not be negative\n",
+				config.min_change);
+		goto end;
+	}
+	if (config.max_rate <= 0) {
+		fprintf(stderr, "update rate (%d) must be positive\n", config.max_rate);
+		goto end;
+	}
 	if (config.manual_time) {
 		if (!isnan(config.latitude) || !isnan(config.longitude)) {
 			fprintf(stderr, "latitude and longitude are not valid in manual time mode\n");
@@ -1036,8 +2329,13 @@ int main(int argc, char *argv[]) {
 		}
 		config.elevation_daylight = RADIANS(90.833 - config.elevation_daylight);
 	}
-	ret = wlrun(config);
+	ret = config.simulation_days > 0 ? simulate(config) : wlrun(config);
+	log_flush();
 end:
 	str_vec_free(&config.output_names);
+	for (size_t idx = 1; idx < config.profiles_len; idx++) {
+		free(config.profiles[idx].pattern);
+	}
+	free(config.profiles);
 	return ret;
 }
@@ -0,0 +1,53 @@
+#define _XOPEN_SOURCE 700
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "matcher.h"
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+int name_matcher_init(struct name_matcher *matcher, const struct str_vec *patterns) {
+	*matcher = (struct name_matcher) { 0 };
+	if (patterns->len == 0) {
+		return 0;
+	}
+	matcher->names = calloc(patterns->len, sizeof(char *));
+	matcher->globs = calloc(patterns->len, sizeof(char *));
+	if (matcher->names == NULL || matcher->globs == NULL) {
+		name_matcher_finish(matcher);
+		return -1;
+	}
+
+	for (size_t idx = 0; idx < patterns->len; ++idx) {
+		const char *pattern = patterns->data[idx];
+		// Descriptions may contain brackets, so globs match literally too
+		matcher->names[matcher->names_len++] = pattern;
+		if (strpbrk(pattern, "*?[") != NULL) {
+			matcher->globs[matcher->globs_len++] = pattern;
+		}
+	}
+	qsort(matcher->names, matcher->names_len, sizeof(char *), compare_names);
+	return 0;
+}
+
+void name_matcher_finish(struct name_matcher *matcher) {
+	free(matcher->names);
+	free(matcher->globs);
+	*matcher = (struct name_matcher) { 0 };
+}
+
+bool name_matcher_match(const struct name_matcher *matcher, const char *name) {
+	if (matcher->names_len > 0 && bsearch(&name, matcher->names,
+			matcher->names_len, sizeof(char *), compare_names) != NULL) {
+		return true;
+	}
+	for (size_t idx = 0; idx < matcher->globs_len; ++idx) {
+		if (fnmatch(matcher->globs[idx], name, 0) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
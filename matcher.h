@@ -0,0 +1,26 @@
+#ifndef _MATCHER_H
+#define _MATCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "str_vec.h"
+
+/*
+ * Matches names against a set of patterns. Every pattern is kept sorted
+ * and binary searched for an exact match, patterns with glob characters are
+ * then tried in order with fnmatch(3). The pattern strings are borrowed and must outlive the matcher.
+ */
+struct name_matcher {
+	const char **names;
+	size_t names_len;
+	const char **globs;
+	size_t globs_len;
+};
+
+int name_matcher_init(struct name_matcher *matcher, const struct str_vec *patterns);
+void name_matcher_finish(struct name_matcher *matcher);
+
+bool name_matcher_match(const struct name_matcher *matcher, const char *name);
+
+#endif
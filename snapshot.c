@@ -0,0 +1,85 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "snapshot.h"
+
+static uint64_t body_checksum(const struct snapshot *snap) {
+	const char *body = (const char *)&snap->header->checksum + sizeof snap->header->checksum;
+	size_t len = snap->size - (body - (const char *)snap->header);
+	return fnv1a(FNV1A_INIT, body, len);
+}
+
+static bool header_matches(const struct snapshot *snap, uint64_t config_hash) {
+	const struct snapshot_header *header = snap->header;
+	return memcmp(header->magic, SNAPSHOT_MAGIC, sizeof header->magic) == 0 &&
+		header->version == SNAPSHOT_VERSION &&
+		header->config_hash == config_hash &&
+		header->checksum == body_checksum(snap);
+}
+
+int snapshot_open(struct snapshot *snap, uint64_t config_hash) {
+	char path[PATH_MAX];
+	if (get_cache_path(path, sizeof path, "snapshot", config_hash) == -1) {
+		return -1;
+	}
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		return -1;
+	}
+	// Only one instance may write it, the others start cold
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	size_t size = sizeof(struct snapshot_header);
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	bool sized = (size_t)st.st_size == size;
+	if (!sized && ftruncate(fd, size) == -1) {
+		close(fd);
+		return -1;
+	}
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	snap->header = data;
+	snap->size = size;
+	snap->fd = fd;
+	snap->valid = sized && header_matches(snap, config_hash);
+	if (!snap->valid) {
+		memset(data, 0, size);
+		memcpy(snap->header->magic, SNAPSHOT_MAGIC, sizeof snap->header->magic);
+		snap->header->version = SNAPSHOT_VERSION;
+		snap->header->config_hash = config_hash;
+	}
+	return 0;
+}
+
+void snapshot_close(struct snapshot *snap) {
+	if (snap->header == NULL) {
+		return;
+	}
+	munmap(snap->header, snap->size);
+	close(snap->fd);
+	snap->header = NULL;
+}
+
+void snapshot_commit(struct snapshot *snap) {
+	snap->header->checksum = body_checksum(snap);
+}
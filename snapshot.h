@@ -0,0 +1,56 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The trajectory for the day and the gamma, kept in a small cache file so
+ * that an instance restarted the same day can set up outputs right away
+ * instead of starting from an unadjusted display. The file is mapped shared, so saving is a plain
+ * memory write and survives crashes. It is locked while in use, another
+ * instance with the same settings and display goes without.
+ *
+ * The file is a single header in native byte order. It is named after a hash
+ * of the settings it was written for.
+ */
+#define SNAPSHOT_MAGIC "wlsunsnp"
+#define SNAPSHOT_VERSION 3
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t config_hash;
+	// Hash of everything after this field, to catch torn writes
+	uint64_t checksum;
+
+	// The trajectory for the day starting at calc_day, in UTC seconds
+	int64_t calc_day;
+	int64_t dawn;
+	int64_t sunrise;
+	int64_t sunset;
+	int64_t night;
+	int32_t state;
+	int32_t condition;
+
+	double gamma;
+};
+
+struct snapshot {
+	struct snapshot_header *header;
+	size_t size;
+	// Held open for the lock
+	int fd;
+	// Whether the file held a usable snapshot when it was opened
+	bool valid;
+};
+
+int snapshot_open(struct snapshot *snap, uint64_t config_hash);
+void snapshot_close(struct snapshot *snap);
+
+// Call after changing the header
+void snapshot_commit(struct snapshot *snap);
+
+#endif
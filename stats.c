@@ -0,0 +1,73 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+
+#include "stats.h"
+
+struct stats stats = { 0 };
+
+int64_t stats_clock(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void histogram_add(struct histogram *hist, int64_t ns) {
+	uint64_t us = ns > 0 ? (uint64_t)ns / 1000 : 0;
+	int bucket = 0;
+	while (bucket < HISTOGRAM_BUCKETS - 1 && us >= (1ULL << bucket)) {
+		bucket++;
+	}
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->sum += us;
+	if (us > hist->max) {
+		hist->max = us;
+	}
+}
+
+static void print_histogram(FILE *f, const char *name, const struct histogram *hist) {
+	uint64_t cumulative = 0;
+	for (int bucket = 0; bucket < HISTOGRAM_BUCKETS - 1; bucket++) {
+		cumulative += hist->buckets[bucket];
+		fprintf(f, "%s_us_bucket{le=\"%llu\"} %llu\n", name,
+			1ULL << bucket, (unsigned long long)cumulative);
+	}
+	fprintf(f, "%s_us_bucket{le=\"+Inf\"} %llu\n", name,
+		(unsigned long long)hist->count);
+	fprintf(f, "%s_us_sum %llu\n", name, (unsigned long long)hist->sum);
+	fprintf(f, "%s_us_count %llu\n", name, (unsigned long long)hist->count);
+	fprintf(f, "%s_us_max %llu\n", name, (unsigned long long)hist->max);
+}
+
+void stats_print(FILE *f) {
+	fprintf(f, "timer_wakeups %llu\n", (unsigned long long)stats.timer_wakeups);
+	fprintf(f, "clock_changes %llu\n", (unsigned long long)stats.clock_changes);
+	fprintf(f, "timezone_changes %llu\n", (unsigned long long)stats.timezone_changes);
+	fprintf(f, "temperature_updates %llu\n",
+		(unsigned long long)stats.temperature_updates);
+	fprintf(f, "temperature_suppressed %llu\n",
+		(unsigned long long)stats.temperature_suppressed);
+	fprintf(f, "whitepoint_suppressed %llu\n",
+		(unsigned long long)stats.whitepoint_suppressed);
+	fprintf(f, "table_fills %llu\n", (unsigned long long)stats.table_fills);
+	fprintf(f, "table_fill_ns %llu\n", (unsigned long long)stats.table_fill_ns);
+	print_histogram(f, "timer_jitter", &stats.timer_jitter);
+	print_histogram(f, "update_latency", &stats.update_latency);
+	print_histogram(f, "commit_spread", &stats.commit_spread);
+}
+
+void stats_print_output(FILE *f, const char *name, uint32_t id,
+		const struct output_stats *output) {
+	fprintf(f, "output_gamma_sets{output=\"%s\",id=\"%u\"} %llu\n", name, id,
+		(unsigned long long)output->gamma_sets);
+	fprintf(f, "output_gamma_bytes{output=\"%s\",id=\"%u\"} %llu\n", name, id,
+		(unsigned long long)output->gamma_bytes);
+	fprintf(f, "output_gamma_sets_suppressed{output=\"%s\",id=\"%u\"} %llu\n",
+		name, id, (unsigned long long)output->gamma_sets_suppressed);
+	fprintf(f, "output_setups{output=\"%s\",id=\"%u\"} %llu\n", name, id,
+		(unsigned long long)output->setups);
+	fprintf(f, "output_failures{output=\"%s\",id=\"%u\"} %llu\n", name, id,
+		(unsigned long long)output->failures);
+	fprintf(f, "output_first_gamma_us{output=\"%s\",id=\"%u\"} %llu\n", name, id,
+		(unsigned long long)output->first_gamma_us);
+}
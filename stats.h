@@ -0,0 +1,65 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Bucket n counts values below 2^n microseconds, the last one everything else
+#define HISTOGRAM_BUCKETS 24
+
+struct histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+/*
+ * Process wide counters. They are only ever touched from the main loop, so
+ * plain increments are enough.
+ */
+struct stats {
+	// Monotonic time at startup, what startup timings are relative to
+	int64_t start_time;
+	uint64_t timer_wakeups;
+	// Wall clock steps, including resume from suspend, and timezone changes
+	uint64_t clock_changes;
+	uint64_t timezone_changes;
+	uint64_t temperature_updates;
+	// Updates dropped because they would not change the temperature or
+	// the whitepoint
+	uint64_t temperature_suppressed;
+	uint64_t whitepoint_suppressed;
+	uint64_t table_fills;
+	uint64_t table_fill_ns;
+
+	// From timer deadline to wakeup
+	struct histogram timer_jitter;
+	// From timer deadline to the gamma tables being sent
+	struct histogram update_latency;
+	// From the first to the last output's gamma request in an update
+	// touching several outputs
+	struct histogram commit_spread;
+};
+
+struct output_stats {
+	uint64_t gamma_sets;
+	uint64_t gamma_bytes;
+	// Tables identical to the last one sent, and therefore not sent
+	uint64_t gamma_sets_suppressed;
+	uint64_t setups;
+	uint64_t failures;
+	// From the output being announced to its first gamma table being sent
+	uint64_t first_gamma_us;
+};
+
+extern struct stats stats;
+
+int64_t stats_clock(void);
+void histogram_add(struct histogram *hist, int64_t ns);
+
+void stats_print(FILE *f);
+void stats_print_output(FILE *f, const char *name, uint32_t id,
+		const struct output_stats *output);
+
+#endif
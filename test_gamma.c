@@ -0,0 +1,109 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "color.h"
+#include "gamma.h"
+
+/*
+ * Checks every kernel this CPU supports against the scalar one, and filled
+ * tables against a double precision reference, at the common ramp sizes.
+ */
+
+static const uint32_t ramp_sizes[] = { 256, 1024, 4096, 65536 };
+static const double gammas[] = { 0.7, 1.0, 2.2 };
+
+static bool check_kernels(const struct gamma_kernel *kernels, size_t kernels_len,
+		const struct gamma_curve *curve, float w, uint16_t *expected, uint16_t *got) {
+	// One short of the ramp size as well, to cover the scalar tails
+	uint32_t lens[] = { curve->ramp_size, curve->ramp_size - 1 };
+	bool ok = true;
+	for (size_t len_idx = 0; len_idx < 2; len_idx++) {
+		uint32_t len = lens[len_idx];
+		kernels[0].scale(expected, curve->curve, w, len);
+		for (size_t idx = 1; idx < kernels_len; idx++) {
+			memset(got, 0, len * sizeof(uint16_t));
+			kernels[idx].scale(got, curve->curve, w, len);
+			if (memcmp(expected, got, len * sizeof(uint16_t)) != 0) {
+				fprintf(stderr, "%s differs from scalar: ramp size %u, len %u, gamma %.2f, w %.1f\n",
+					kernels[idx].name, curve->ramp_size, len, curve->gamma, w);
+				ok = false;
+			}
+		}
+	}
+	return ok;
+}
+
+static bool check_table(const struct gamma_curve *curve, const struct rgb *wp,
+		const uint16_t *table) {
+	uint32_t ramp_size = curve->ramp_size;
+	double channels[3] = { wp->r, wp->g, wp->b };
+	double max_error = 0.0;
+	for (int c = 0; c < 3; c++) {
+		double w = pow(channels[c], 1.0 / curve->gamma);
+		for (uint32_t i = 0; i < ramp_size; i++) {
+			double v = pow((double)i / (ramp_size - 1), 1.0 / curve->gamma);
+			double expected = floor(UINT16_MAX * v * w);
+			double error = fabs(table[c * ramp_size + i] - expected);
+			if (error > max_error) {
+				max_error = error;
+			}
+		}
+	}
+	if (max_error > GAMMA_TABLE_MAX_ERROR) {
+		fprintf(stderr, "table off by %.0f: ramp size %u, gamma %.2f, wp %f %f %f\n",
+			max_error, ramp_size, curve->gamma, wp->r, wp->g, wp->b);
+		return false;
+	}
+	return true;
+}
+
+int main(void) {
+	struct gamma_kernel kernels[GAMMA_KERNELS_MAX];
+	size_t kernels_len = gamma_kernels(kernels);
+	for (size_t idx = 0; idx < kernels_len; idx++) {
+		printf("kernel %s\n", kernels[idx].name);
+	}
+
+	uint16_t *expected = malloc(65536 * sizeof(uint16_t));
+	uint16_t *got = malloc(65536 * sizeof(uint16_t));
+	if (expected == NULL || got == NULL) {
+		fprintf(stderr, "could not allocate buffers\n");
+		return EXIT_FAILURE;
+	}
+
+	bool ok = true;
+	for (size_t size_idx = 0; size_idx < sizeof ramp_sizes / sizeof ramp_sizes[0]; size_idx++) {
+		for (size_t gamma_idx = 0; gamma_idx < sizeof gammas / sizeof gammas[0]; gamma_idx++) {
+			struct gamma_curve *curve = gamma_curve_get(ramp_sizes[size_idx], gammas[gamma_idx]);
+			if (curve == NULL) {
+				fprintf(stderr, "could not create gamma curve\n");
+				return EXIT_FAILURE;
+			}
+			for (int temp = 1000; temp <= 10000; temp += 500) {
+				struct rgb wp = calc_whitepoint(temp);
+				double channels[3] = { wp.r, wp.g, wp.b };
+				for (int c = 0; c < 3; c++) {
+					float w = UINT16_MAX * pow(channels[c], 1.0 / curve->gamma);
+					ok &= check_kernels(kernels, kernels_len, curve, w, expected, got);
+				}
+
+				struct gamma_table *table = gamma_table_get(curve, &wp);
+				if (table == NULL) {
+					fprintf(stderr, "could not create gamma table\n");
+					return EXIT_FAILURE;
+				}
+				ok &= check_table(curve, &wp, table->data);
+				gamma_table_put(table);
+			}
+			gamma_curve_put(curve);
+		}
+	}
+
+	free(expected);
+	free(got);
+	printf("%s\n", ok ? "ok" : "failed");
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,857 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <wayland-server.h>
+
+#include "wlr-gamma-control-unstable-v1-server-protocol.h"
+#include "stats.h"
+
+/*
+ * A stand-in compositor for integration tests. It offers wl_output and
+ * zwlr_gamma_control_manager_v1 to a wlsunset it starts on a socket pair,
+ * and records every gamma table it is sent along with the time it arrived.
+ * Outputs can be added and removed, report any gamma size including 0, and
+ * fail their gamma control. Neither a GPU nor a session is needed.
+ *
+ * Each scenario prints its timings in the same "name{labels} value" format
+ * as the runtime statistics, and fails if wlsunset misbehaves or exits.
+ */
+
+#define WAIT_TIMEOUT_NS (10 * 1000000000LL)
+
+struct test_output {
+	struct wl_list link;
+	struct server *server;
+	struct wl_global *global;
+	uint32_t id;
+	char name[32];
+	uint32_t gamma_size;
+	// Send failed instead of the gamma size to the next gamma control
+	bool fail;
+	bool removed;
+
+	// The control tables are taken from, failed ones are ignored
+	struct wl_resource *gamma_control;
+	int64_t added;
+	int64_t control_created;
+	uint32_t controls;
+	uint32_t tables;
+	int64_t first_table;
+	const uint16_t *last_table;
+};
+
+struct record {
+	struct test_output *output;
+	int64_t time;
+	uint32_t gamma_size;
+	uint16_t *table;
+};
+
+struct server {
+	const char *wlsunset;
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wl_list outputs;
+	uint32_t next_id;
+	uint32_t controls_live;
+
+	struct record *records;
+	size_t records_len, records_cap;
+	// Benchmarks only read tables, as a compositor would, and drop them
+	bool drop_tables;
+
+	pid_t child;
+	int child_status;
+	char dir[64];
+
+	int control_fd;
+	struct wl_event_source *control_source;
+	char reply[256];
+	size_t reply_len;
+	uint32_t replies;
+
+	// What the current wait is for
+	size_t target;
+};
+
+static void record_table(struct test_output *output, int fd) {
+	struct server *server = output->server;
+	size_t size = output->gamma_size * 3 * sizeof(uint16_t);
+	uint16_t *table = malloc(size);
+	if (table == NULL) {
+		wl_resource_post_no_memory(output->gamma_control);
+		return;
+	}
+	size_t done = 0;
+	while (done < size) {
+		ssize_t res = pread(fd, (char *)table + done, size - done, done);
+		if (res == -1 && errno == EINTR) {
+			continue;
+		} else if (res <= 0) {
+			break;
+		}
+		done += res;
+	}
+	if (done != size) {
+		free(table);
+		wl_resource_post_error(output->gamma_control,
+			ZWLR_GAMMA_CONTROL_V1_ERROR_INVALID_GAMMA,
+			"gamma table too short: %zu of %zu bytes", done, size);
+		return;
+	}
+
+	if (server->records_len == server->records_cap) {
+		size_t cap = server->records_cap == 0 ? 64 : server->records_cap * 2;
+		struct record *records = realloc(server->records, cap * sizeof(struct record));
+		if (records == NULL) {
+			free(table);
+			wl_resource_post_no_memory(output->gamma_control);
+			return;
+		}
+		server->records = records;
+		server->records_cap = cap;
+	}
+	if (server->drop_tables) {
+		free(table);
+		table = NULL;
+	}
+	int64_t now = stats_clock();
+	server->records[server->records_len++] = (struct record) {
+		.output = output,
+		.time = now,
+		.gamma_size = output->gamma_size,
+		.table = table,
+	};
+	if (output->tables == 0) {
+		output->first_table = now;
+	}
+	output->tables++;
+	output->last_table = table;
+}
+
+static void gamma_control_handle_set_gamma(struct wl_client *client,
+		struct wl_resource *resource, int32_t fd) {
+	(void)client;
+	struct test_output *output = wl_resource_get_user_data(resource);
+	// Tables sent to a failed control are ignored, as in wlroots
+	if (output->gamma_control == resource) {
+		record_table(output, fd);
+	}
+	close(fd);
+}
+
+static void gamma_control_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_gamma_control_v1_interface gamma_control_impl = {
+	.set_gamma = gamma_control_handle_set_gamma,
+	.destroy = gamma_control_handle_destroy,
+};
+
+static void gamma_control_destroy(struct wl_resource *resource) {
+	struct test_output *output = wl_resource_get_user_data(resource);
+	output->server->controls_live--;
+	if (output->gamma_control == resource) {
+		output->gamma_control = NULL;
+	}
+}
+
+static void manager_handle_get_gamma_control(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, struct wl_resource *output_resource) {
+	struct test_output *output = wl_resource_get_user_data(output_resource);
+	struct wl_resource *control = wl_resource_create(client,
+		&zwlr_gamma_control_v1_interface, wl_resource_get_version(resource), id);
+	if (control == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(control, &gamma_control_impl, output,
+		gamma_control_destroy);
+	output->server->controls_live++;
+	output->controls++;
+
+	// Only one client may control an output's gamma at a time
+	if (output->removed || output->gamma_control != NULL || output->fail) {
+		output->fail = false;
+		zwlr_gamma_control_v1_send_failed(control);
+		return;
+	}
+	output->gamma_control = control;
+	output->control_created = stats_clock();
+	zwlr_gamma_control_v1_send_gamma_size(control, output->gamma_size);
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_gamma_control_manager_v1_interface manager_impl = {
+	.get_gamma_control = manager_handle_get_gamma_control,
+	.destroy = manager_handle_destroy,
+};
+
+static void manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwlr_gamma_control_manager_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &manager_impl, data, NULL);
+}
+
+static void output_handle_release(struct wl_client *client,
+		struct wl_resource *resource) {
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_output_interface output_impl = {
+	.release = output_handle_release,
+};
+
+static void output_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct test_output *output = data;
+	struct wl_resource *resource = wl_resource_create(client,
+		&wl_output_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &output_impl, output, NULL);
+
+	wl_output_send_geometry(resource, 0, 0, 600, 340, WL_OUTPUT_SUBPIXEL_UNKNOWN,
+		"wlsunset", "test output", WL_OUTPUT_TRANSFORM_NORMAL);
+	wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT, 1920, 1080, 60000);
+	if (version >= WL_OUTPUT_SCALE_SINCE_VERSION) {
+		wl_output_send_scale(resource, 1);
+	}
+	if (version >= WL_OUTPUT_NAME_SINCE_VERSION) {
+		wl_output_send_name(resource, output->name);
+		wl_output_send_description(resource, "wlsunset test output");
+	}
+	if (version >= WL_OUTPUT_DONE_SINCE_VERSION) {
+		wl_output_send_done(resource);
+	}
+}
+
+static struct test_output *add_output(struct server *server, uint32_t gamma_size) {
+	struct test_output *output = calloc(1, sizeof(struct test_output));
+	if (output == NULL) {
+		return NULL;
+	}
+	output->server = server;
+	output->id = ++server->next_id;
+	output->gamma_size = gamma_size;
+	snprintf(output->name, sizeof output->name, "TEST-%u", output->id);
+	output->global = wl_global_create(server->display, &wl_output_interface,
+		4, output, output_bind);
+	if (output->global == NULL) {
+		free(output);
+		return NULL;
+	}
+	output->added = stats_clock();
+	wl_list_insert(server->outputs.prev, &output->link);
+	return output;
+}
+
+// The output is kept around, as wlsunset may still refer to it
+static void remove_output(struct test_output *output) {
+	output->removed = true;
+	wl_global_remove(output->global);
+}
+
+static int handle_control(int fd, uint32_t mask, void *data) {
+	(void)mask;
+	struct server *server = data;
+	ssize_t res = read(fd, server->reply + server->reply_len,
+		sizeof server->reply - server->reply_len);
+	if (res <= 0) {
+		if (res == -1 && errno == EAGAIN) {
+			return 0;
+		}
+		fprintf(stderr, "control socket closed\n");
+		wl_event_source_remove(server->control_source);
+		server->control_source = NULL;
+		return 0;
+	}
+	server->reply_len += res;
+
+	char *line = server->reply;
+	char *end;
+	while ((end = memchr(line, '\n', server->reply_len - (line - server->reply))) != NULL) {
+		*end = '\0';
+		// Queries reply with data, the rest with ok or error
+		if (strncmp(line, "error", 5) == 0) {
+			fprintf(stderr, "control command failed: %s\n", line);
+		}
+		server->replies++;
+		line = end + 1;
+	}
+	server->reply_len -= line - server->reply;
+	memmove(server->reply, line, server->reply_len);
+	return 0;
+}
+
+static bool child_running(struct server *server) {
+	if (server->child == -1) {
+		return false;
+	}
+	pid_t res = waitpid(server->child, &server->child_status, WNOHANG);
+	if (res == 0) {
+		return true;
+	}
+	fprintf(stderr, "wlsunset exited unexpectedly (status %d)\n", server->child_status);
+	server->child = -1;
+	return false;
+}
+
+static bool records_reached(struct server *server) {
+	return server->records_len >= server->target;
+}
+
+static bool controls_reached(struct server *server) {
+	return server->controls_live == server->target;
+}
+
+static bool replies_reached(struct server *server) {
+	return server->replies >= server->target;
+}
+
+// Runs the compositor until the condition holds, false on a timeout or exit
+static bool wait_for(struct server *server, bool (*done)(struct server *), size_t target) {
+	server->target = target;
+	int64_t deadline = stats_clock() + WAIT_TIMEOUT_NS;
+	while (!done(server)) {
+		if (!child_running(server)) {
+			return false;
+		}
+		int64_t now = stats_clock();
+		if (now >= deadline) {
+			fprintf(stderr, "timed out\n");
+			return false;
+		}
+		wl_display_flush_clients(server->display);
+		// Short enough to notice the child exiting
+		wl_event_loop_dispatch(server->loop, 100);
+	}
+	wl_display_flush_clients(server->display);
+	return true;
+}
+
+static bool wait_records(struct server *server, size_t count) {
+	return wait_for(server, records_reached, count);
+}
+
+static bool wait_controls(struct server *server, size_t count) {
+	return wait_for(server, controls_reached, count);
+}
+
+static int send_command(struct server *server, const char *command) {
+	char line[128];
+	int len = snprintf(line, sizeof line, "%s\n", command);
+	if (len < 0 || (size_t)len >= sizeof line ||
+			send(server->control_fd, line, len, MSG_NOSIGNAL) != len) {
+		fprintf(stderr, "could not send control command: %s\n", command);
+		return -1;
+	}
+	return 0;
+}
+
+// Sends a command and waits for its reply, so its tables have been sent
+static int run_command(struct server *server, const char *command) {
+	uint32_t replies = server->replies;
+	if (send_command(server, command) == -1 ||
+			!wait_for(server, replies_reached, replies + 1)) {
+		return -1;
+	}
+	return 0;
+}
+
+static int connect_control(struct server *server) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof addr.sun_path, "%s/control", server->dir);
+	int64_t deadline = stats_clock() + WAIT_TIMEOUT_NS;
+	while (true) {
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd == -1) {
+			return -1;
+		}
+		if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0) {
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			server->control_fd = fd;
+			server->control_source = wl_event_loop_add_fd(server->loop, fd,
+				WL_EVENT_READABLE, handle_control, server);
+			return server->control_source == NULL ? -1 : 0;
+		}
+		close(fd);
+		// The socket appears once wlsunset has connected to us
+		if (!child_running(server) || stats_clock() >= deadline) {
+			fprintf(stderr, "could not connect to the control socket\n");
+			return -1;
+		}
+		wl_display_flush_clients(server->display);
+		wl_event_loop_dispatch(server->loop, 10);
+	}
+}
+
+static int start_wlsunset(struct server *server, bool quiet) {
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+		perror("socketpair");
+		return -1;
+	}
+	if (wl_client_create(server->display, fds[0]) == NULL) {
+		fprintf(stderr, "could not create client\n");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	char control_path[128], cache_path[128], socket_fd[16];
+	snprintf(control_path, sizeof control_path, "%s/control", server->dir);
+	snprintf(cache_path, sizeof cache_path, "%s/cache", server->dir);
+	snprintf(socket_fd, sizeof socket_fd, "%d", fds[1]);
+
+	server->child = fork();
+	if (server->child == -1) {
+		perror("fork");
+		close(fds[1]);
+		return -1;
+	} else if (server->child == 0) {
+		fcntl(fds[1], F_SETFD, 0);
+		// A fresh cache, so that every run starts cold
+		setenv("WAYLAND_SOCKET", socket_fd, 1);
+		setenv("XDG_CACHE_HOME", cache_path, 1);
+		setenv("XDG_RUNTIME_DIR", server->dir, 1);
+		unsetenv("WAYLAND_DISPLAY");
+		execl(server->wlsunset, server->wlsunset, "-l", "52.0", "-L", "0.0", "-c", control_path,
+			"-V", quiet ? "warn" : "info", (char *)NULL);
+		perror("exec");
+		_exit(127);
+	}
+	close(fds[1]);
+	return connect_control(server);
+}
+
+static int stop_wlsunset(struct server *server) {
+	if (server->child == -1) {
+		return -1;
+	}
+	kill(server->child, SIGTERM);
+	if (waitpid(server->child, &server->child_status, 0) == -1) {
+		return -1;
+	}
+	server->child = -1;
+	if (!WIFEXITED(server->child_status) || WEXITSTATUS(server->child_status) != 0) {
+		fprintf(stderr, "wlsunset did not exit cleanly (status %d)\n",
+			server->child_status);
+		return -1;
+	}
+	return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+	(void)st, (void)flag, (void)ftw;
+	return remove(path);
+}
+
+static int server_init(struct server *server, const char *wlsunset) {
+	*server = (struct server) {
+		.wlsunset = wlsunset,
+		.child = -1,
+		.control_fd = -1,
+	};
+	wl_list_init(&server->outputs);
+	const char *tmp = getenv("TMPDIR");
+	snprintf(server->dir, sizeof server->dir, "%s/wlsunset-test-XXXXXX",
+		tmp != NULL && strlen(tmp) < 32 ? tmp : "/tmp");
+	if (mkdtemp(server->dir) == NULL) {
+		perror("mkdtemp");
+		return -1;
+	}
+	server->display = wl_display_create();
+	if (server->display == NULL) {
+		return -1;
+	}
+	server->loop = wl_display_get_event_loop(server->display);
+	if (wl_global_create(server->display, &zwlr_gamma_control_manager_v1_interface,
+			1, server, manager_bind) == NULL) {
+		return -1;
+	}
+	return 0;
+}
+
+static void server_finish(struct server *server) {
+	if (server->child != -1) {
+		kill(server->child, SIGKILL);
+		waitpid(server->child, NULL, 0);
+	}
+	if (server->control_source != NULL) {
+		wl_event_source_remove(server->control_source);
+	}
+	if (server->control_fd != -1) {
+		close(server->control_fd);
+	}
+	if (server->display != NULL) {
+		wl_display_destroy_clients(server->display);
+		wl_display_destroy(server->display);
+	}
+	struct test_output *output, *tmp;
+	wl_list_for_each_safe(output, tmp, &server->outputs, link) {
+		wl_list_remove(&output->link);
+		free(output);
+	}
+	for (size_t idx = 0; idx < server->records_len; idx++) {
+		free(server->records[idx].table);
+	}
+	free(server->records);
+	nftw(server->dir, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+}
+
+// Channels must rise with the input, and red is never scaled down
+static bool check_table(const struct record *record) {
+	uint32_t size = record->gamma_size;
+	for (int channel = 0; channel < 3; channel++) {
+		const uint16_t *ramp = record->table + channel * size;
+		for (uint32_t idx = 1; idx < size; idx++) {
+			if (ramp[idx] < ramp[idx - 1]) {
+				fprintf(stderr, "%s: channel %d falls at %u\n",
+					record->output->name, channel, idx);
+				return false;
+			}
+		}
+	}
+	if (record->table[size - 1] != UINT16_MAX) {
+		fprintf(stderr, "%s: red ends at %u\n", record->output->name,
+			record->table[size - 1]);
+		return false;
+	}
+	return true;
+}
+
+static bool check_records(struct server *server) {
+	for (size_t idx = 0; idx < server->records_len; idx++) {
+		if (!check_table(&server->records[idx])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+static int add_outputs(struct server *server, int count) {
+	static const uint32_t sizes[] = { 256, 1024, 4096 };
+	for (int idx = 0; idx < count; idx++) {
+		if (add_output(server, sizes[idx % 3]) == NULL) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Every output gets a valid table soon after wlsunset connects
+static int scenario_first_gamma(struct server *server, int count) {
+	if (add_outputs(server, count) == -1) {
+		return -1;
+	}
+	int64_t start = stats_clock();
+	if (start_wlsunset(server, false) == -1 || !wait_records(server, count)) {
+		return -1;
+	}
+
+	struct test_output *output;
+	wl_list_for_each(output, &server->outputs, link) {
+		if (output->tables == 0) {
+			fprintf(stderr, "%s: no gamma table\n", output->name);
+			return -1;
+		}
+		printf("first_gamma_ns{output=\"%s\",gamma_size=\"%u\"} %lld\n",
+			output->name, output->gamma_size,
+			(long long)(output->first_table - output->control_created));
+		printf("first_gamma_since_start_ns{output=\"%s\",gamma_size=\"%u\"} %lld\n",
+			output->name, output->gamma_size,
+			(long long)(output->first_table - start));
+	}
+	return check_records(server) ? stop_wlsunset(server) : -1;
+}
+
+// An output without a gamma size gets nothing until it reports one
+static int scenario_zero_size(struct server *server, int count) {
+	(void)count;
+	struct test_output *zero = add_output(server, 0);
+	struct test_output *sized = add_output(server, 256);
+	if (zero == NULL || sized == NULL) {
+		return -1;
+	}
+	// wlsunset drops the control of the output without a size
+	if (start_wlsunset(server, false) == -1 || !wait_records(server, 1) ||
+			!wait_controls(server, 1) || run_command(server, "query") == -1) {
+		return -1;
+	}
+	if (zero->tables != 0) {
+		fprintf(stderr, "%s: got a table with a gamma size of 0\n", zero->name);
+		return -1;
+	}
+
+	// The next update tries again, and now there is a CRTC
+	zero->gamma_size = 512;
+	if (run_command(server, "temperature 3000") == -1 ||
+			!wait_records(server, 3)) {
+		return -1;
+	}
+	if (zero->tables != 1 || zero->controls < 2 || sized->tables != 2) {
+		fprintf(stderr, "unexpected tables: %s %u, %s %u\n",
+			zero->name, zero->tables, sized->name, sized->tables);
+		return -1;
+	}
+	return check_records(server) ? stop_wlsunset(server) : -1;
+}
+
+// A failed gamma control is dropped and set up again on the next update
+static int scenario_failed(struct server *server, int count) {
+	(void)count;
+	struct test_output *good = add_output(server, 256);
+	struct test_output *bad = add_output(server, 1024);
+	if (good == NULL || bad == NULL) {
+		return -1;
+	}
+	bad->fail = true;
+	if (start_wlsunset(server, false) == -1 || !wait_records(server, 1) ||
+			!wait_controls(server, 1)) {
+		return -1;
+	}
+	if (bad->tables != 0) {
+		fprintf(stderr, "%s: table sent to a failed gamma control\n", bad->name);
+		return -1;
+	}
+
+	if (run_command(server, "temperature 3000") == -1 ||
+			!wait_records(server, 3)) {
+		return -1;
+	}
+	if (good->tables != 2 || bad->tables != 1 || bad->controls != 2) {
+		fprintf(stderr, "unexpected tables: %s %u, %s %u\n",
+			good->name, good->tables, bad->name, bad->tables);
+		return -1;
+	}
+	return check_records(server) ? stop_wlsunset(server) : -1;
+}
+
+// Outputs added later get a table right away, removed ones no more
+static int scenario_hotplug(struct server *server, int count) {
+	(void)count;
+	struct test_output *first = add_output(server, 256);
+	if (first == NULL || start_wlsunset(server, false) == -1 ||
+			!wait_records(server, 1)) {
+		return -1;
+	}
+
+	struct test_output *second = add_output(server, 1024);
+	if (second == NULL || !wait_records(server, 2)) {
+		return -1;
+	}
+	printf("hotplug_first_gamma_ns{output=\"%s\",gamma_size=\"%u\"} %lld\n",
+		second->name, second->gamma_size,
+		(long long)(second->first_table - second->added));
+
+	remove_output(first);
+	if (!wait_controls(server, 1) || run_command(server, "temperature 3000") == -1 ||
+			!wait_records(server, 3)) {
+		return -1;
+	}
+	if (first->tables != 1 || second->tables != 2) {
+		fprintf(stderr, "unexpected tables: %s %u, %s %u\n",
+			first->name, first->tables, second->name, second->tables);
+		return -1;
+	}
+
+	// Plugged back in, which announces a new global
+	struct test_output *third = add_output(server, 256);
+	if (third == NULL || !wait_records(server, 4)) {
+		return -1;
+	}
+	if (third->tables != 1 || memcmp(third->last_table,
+			first->last_table, 3 * 256 * sizeof(uint16_t)) == 0) {
+		fprintf(stderr, "%s: not at the forced temperature\n", third->name);
+		return -1;
+	}
+	return check_records(server) ? stop_wlsunset(server) : -1;
+}
+
+// Alternates the forced temperature, timing each command until the last
+// output has its new table
+static int time_updates(struct server *server, int outputs, int rounds,
+		int64_t *sum, int64_t *max) {
+	*sum = 0;
+	*max = 0;
+	for (int round = 0; round < rounds; round++) {
+		char command[32];
+		snprintf(command, sizeof command, "temperature %d", round % 2 ? 3000 : 3500);
+		size_t expected = server->records_len + outputs;
+		int64_t sent = stats_clock();
+		if (send_command(server, command) == -1 || !wait_records(server, expected)) {
+			return -1;
+		}
+		int64_t latency = server->records[expected - 1].time - sent;
+		*sum += latency;
+		*max = latency > *max ? latency : *max;
+	}
+	return 0;
+}
+
+// From a control command to the last output's new table
+static int scenario_update_latency(struct server *server, int count) {
+	if (add_outputs(server, count) == -1 || start_wlsunset(server, false) == -1 ||
+			!wait_records(server, count)) {
+		return -1;
+	}
+
+	const int rounds = 50;
+	int64_t sum, max;
+	if (time_updates(server, count, rounds, &sum, &max) == -1) {
+		return -1;
+	}
+	printf("update_latency_ns{outputs=\"%d\",stat=\"mean\"} %lld\n", count,
+		(long long)(sum / rounds));
+	printf("update_latency_ns{outputs=\"%d\",stat=\"max\"} %lld\n", count,
+		(long long)max);
+	return check_records(server) ? stop_wlsunset(server) : -1;
+}
+
+// set_temperature() end to end, including the compositor receiving tables
+static int scenario_set_temperature(struct server *server, int count) {
+	server->drop_tables = true;
+	if (add_outputs(server, count) == -1 || start_wlsunset(server, true) == -1 ||
+			!wait_records(server, count)) {
+		return -1;
+	}
+
+	const int rounds = 200;
+	int64_t sum, max;
+	if (time_updates(server, count, rounds, &sum, &max) == -1) {
+		return -1;
+	}
+	printf("bench_ns_per_op{bench=\"set_temperature\",outputs=\"%d\"} %.1f\n",
+		count, (double)sum / rounds);
+	printf("bench_ops_per_sec{bench=\"set_temperature\",outputs=\"%d\"} %.0f\n",
+		count, rounds * 1e9 / sum);
+	printf("bench_outputs_per_sec{bench=\"set_temperature\",outputs=\"%d\"} %.0f\n",
+		count, (double)rounds * count * 1e9 / sum);
+	return stop_wlsunset(server);
+}
+
+// Adds a burst of outputs while running and removes them again
+static int scenario_output_churn(struct server *server, int count) {
+	server->drop_tables = true;
+	if (start_wlsunset(server, true) == -1) {
+		return -1;
+	}
+
+	const int rounds = 5;
+	int64_t add_ns = 0, remove_ns = 0;
+	for (int round = 0; round < rounds; round++) {
+		size_t expected = server->records_len + count;
+		int64_t start = stats_clock();
+		if (add_outputs(server, count) == -1 || !wait_records(server, expected)) {
+			return -1;
+		}
+		add_ns += stats_clock() - start;
+
+		start = stats_clock();
+		struct test_output *output;
+		wl_list_for_each(output, &server->outputs, link) {
+			if (!output->removed) {
+				remove_output(output);
+			}
+		}
+		if (!wait_controls(server, 0)) {
+			return -1;
+		}
+		remove_ns += stats_clock() - start;
+	}
+
+	uint64_t ops = (uint64_t)rounds * count;
+	printf("bench_ns_per_op{bench=\"output_add\",outputs=\"%d\"} %.1f\n",
+		count, (double)add_ns / ops);
+	printf("bench_ops_per_sec{bench=\"output_add\",outputs=\"%d\"} %.0f\n",
+		count, ops * 1e9 / add_ns);
+	printf("bench_ns_per_op{bench=\"output_remove\",outputs=\"%d\"} %.1f\n",
+		count, (double)remove_ns / ops);
+	printf("bench_ops_per_sec{bench=\"output_remove\",outputs=\"%d\"} %.0f\n",
+		count, ops * 1e9 / remove_ns);
+	return stop_wlsunset(server);
+}
+
+static const struct scenario {
+	const char *name;
+	int (*run)(struct server *server, int count);
+	int count;
+} scenarios[] = {
+	{ "first-gamma", scenario_first_gamma, 3 },
+	{ "zero-size", scenario_zero_size, 0 },
+	{ "failed", scenario_failed, 0 },
+	{ "hotplug", scenario_hotplug, 0 },
+	{ "update-latency", scenario_update_latency, 4 },
+	{ "set-temperature", scenario_set_temperature, 16 },
+	{ "output-churn", scenario_output_churn, 500 },
+};
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s <wlsunset> <scenario> [count]\n\nscenarios:", name);
+	for (size_t idx = 0; idx < sizeof scenarios / sizeof scenarios[0]; idx++) {
+		fprintf(stderr, " %s", scenarios[idx].name);
+	}
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3 || argc > 4) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	const struct scenario *scenario = NULL;
+	for (size_t idx = 0; idx < sizeof scenarios / sizeof scenarios[0]; idx++) {
+		if (strcmp(argv[2], scenarios[idx].name) == 0) {
+			scenario = &scenarios[idx];
+		}
+	}
+	int count = scenario != NULL ? scenario->count : 0;
+	if (argc == 4) {
+		char *end;
+		count = strtol(argv[3], &end, 10);
+		if (*end != '\0' || count < 1 || count > 10000) {
+			scenario = NULL;
+		}
+	}
+	if (scenario == NULL) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct server server;
+	int ret = EXIT_FAILURE;
+	if (server_init(&server, argv[1]) == 0 && scenario->run(&server, count) == 0) {
+		ret = EXIT_SUCCESS;
+	}
+	server_finish(&server);
+	return ret;
+}
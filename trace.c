@@ -0,0 +1,111 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static struct trace_event ring[TRACE_EVENTS];
+// Total number of events recorded, the next slot is head % TRACE_EVENTS
+static atomic_uint_fast64_t head;
+
+static int64_t clock_ns(clockid_t clock) {
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void trace_event(enum trace_type type, uint32_t id, int64_t arg) {
+	uint64_t slot = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed);
+	ring[slot % TRACE_EVENTS] = (struct trace_event) {
+		.time = clock_ns(CLOCK_MONOTONIC),
+		.type = type,
+		.id = id,
+		.arg = arg,
+	};
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+	const char *bytes = data;
+	while (len > 0) {
+		ssize_t written = write(fd, bytes, len);
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		bytes += written;
+		len -= written;
+	}
+	return 0;
+}
+
+int trace_write(const char *path) {
+	char tmp_path[PATH_MAX];
+	int res = snprintf(tmp_path, sizeof tmp_path, "%s.XXXXXX", path);
+	if (res < 0 || (size_t)res >= sizeof tmp_path) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	int fd = mkstemp(tmp_path);
+	if (fd == -1) {
+		return -1;
+	}
+
+	// Events recorded by workers during the dump may be torn, but dumps
+	// happen from the main loop while no tables are being filled
+	uint64_t end = atomic_load_explicit(&head, memory_order_acquire);
+	uint64_t start = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+	struct trace_header header = {
+		.version = TRACE_VERSION,
+		.event_size = sizeof(struct trace_event),
+		.count = end - start,
+		.realtime_offset = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC),
+	};
+	memcpy(header.magic, TRACE_MAGIC, sizeof header.magic);
+
+	// The oldest events sit right after the newest ones in the ring
+	size_t first = start % TRACE_EVENTS;
+	size_t wrapped = first + header.count > TRACE_EVENTS ?
+		first + header.count - TRACE_EVENTS : 0;
+	res = write_all(fd, &header, sizeof header);
+	if (res == 0) {
+		res = write_all(fd, &ring[first],
+			(header.count - wrapped) * sizeof(struct trace_event));
+	}
+	if (res == 0) {
+		res = write_all(fd, ring, wrapped * sizeof(struct trace_event));
+	}
+	if (close(fd) == -1 || res == -1 || rename(tmp_path, path) == -1) {
+		int err = errno;
+		unlink(tmp_path);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+static const char *type_names[] = {
+	[TRACE_TIMER_FIRE] = "timer_fire",
+	[TRACE_RECALC_STOPS] = "recalc_stops",
+	[TRACE_WHITEPOINT] = "whitepoint",
+	[TRACE_TABLE_FILL] = "table_fill",
+	[TRACE_SET_GAMMA] = "set_gamma",
+	[TRACE_FLUSH] = "flush",
+	[TRACE_OUTPUT_ADDED] = "output_added",
+	[TRACE_OUTPUT_REMOVED] = "output_removed",
+	[TRACE_GAMMA_FAILED] = "gamma_failed",
+};
+
+const char *trace_type_name(uint32_t type) {
+	if (type == 0 || type >= TRACE_TYPE_LAST) {
+		return "unknown";
+	}
+	return type_names[type];
+}
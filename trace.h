@@ -0,0 +1,65 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+/*
+ * A fixed-size in-memory ring of timestamped events, for looking into
+ * latency problems after the fact. Recording an event is a clock read and a
+ * few stores, so it is always on. Only the most recent TRACE_EVENTS events
+ * are kept.
+ *
+ * A dump is a trace_header followed by count trace_event records, oldest
+ * first, in native byte order. Event times are CLOCK_MONOTONIC nanoseconds,
+ * realtime_offset converts them to CLOCK_REALTIME. wlsunset-trace turns a
+ * dump into text or Chrome trace JSON.
+ */
+#define TRACE_MAGIC "wlsuntrc"
+#define TRACE_VERSION 1
+#define TRACE_EVENTS 4096
+
+enum trace_type {
+	// arg: nanoseconds after the deadline
+	TRACE_TIMER_FIRE = 1,
+	// arg: start of the new day in UTC seconds
+	TRACE_RECALC_STOPS,
+	// id: profile index, arg: temperature
+	TRACE_WHITEPOINT,
+	// id: ramp size, arg: nanoseconds spent filling
+	TRACE_TABLE_FILL,
+	// id: output, arg: table size in bytes
+	TRACE_SET_GAMMA,
+	// arg: bytes flushed to the compositor
+	TRACE_FLUSH,
+	// id: output
+	TRACE_OUTPUT_ADDED,
+	TRACE_OUTPUT_REMOVED,
+	TRACE_GAMMA_FAILED,
+	TRACE_TYPE_LAST,
+};
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t event_size;
+	uint64_t count;
+	// Add to an event time to get CLOCK_REALTIME nanoseconds
+	int64_t realtime_offset;
+};
+
+struct trace_event {
+	int64_t time;
+	uint32_t type;
+	uint32_t id;
+	int64_t arg;
+};
+
+// Safe to call from any thread
+void trace_event(enum trace_type type, uint32_t id, int64_t arg);
+
+// Writes the ring to path, replacing it atomically
+int trace_write(const char *path);
+
+const char *trace_type_name(uint32_t type);
+
+#endif
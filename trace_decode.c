@@ -0,0 +1,106 @@
+#define _POSIX_C_SOURCE 200809L
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static void print_text(const struct trace_header *header,
+		const struct trace_event *events) {
+	int64_t last = header->count > 0 ? events[0].time : 0;
+	for (uint64_t idx = 0; idx < header->count; idx++) {
+		const struct trace_event *event = &events[idx];
+		int64_t real = event->time + header->realtime_offset;
+		time_t sec = real / 1000000000LL;
+		struct tm tm;
+		localtime_r(&sec, &tm);
+		printf("%02d:%02d:%02d.%06d %+10.3f ms %-14s id=%" PRIu32 " arg=%" PRId64 "\n",
+			tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(real % 1000000000LL / 1000),
+			(event->time - last) / 1e6, trace_type_name(event->type),
+			event->id, event->arg);
+		last = event->time;
+	}
+}
+
+// Table fills carry their duration and become complete events, the rest are instants
+static void print_chrome(const struct trace_header *header,
+		const struct trace_event *events) {
+	printf("{\"traceEvents\":[\n");
+	for (uint64_t idx = 0; idx < header->count; idx++) {
+		const struct trace_event *event = &events[idx];
+		bool fill = event->type == TRACE_TABLE_FILL;
+		int64_t start = fill ? event->time - event->arg : event->time;
+		printf("{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,", trace_type_name(event->type),
+			fill ? "X" : "i", start / 1e3);
+		if (fill) {
+			printf("\"dur\":%.3f,", event->arg / 1e3);
+		} else {
+			printf("\"s\":\"g\",");
+		}
+		printf("\"pid\":1,\"tid\":1,\"args\":{\"id\":%" PRIu32 ",\"arg\":%" PRId64 "}}%s\n",
+			event->id, event->arg, idx + 1 < header->count ? "," : "");
+	}
+	printf("]}\n");
+}
+
+static const char usage[] = "usage: %s [-j] <trace>\n"
+"  -h             show this help message\n"
+"  -j             print Chrome trace JSON instead of text\n";
+
+int main(int argc, char *argv[]) {
+	bool json = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "hj")) != -1) {
+		switch (opt) {
+			case 'j':
+				json = true;
+				break;
+			case 'h':
+				printf(usage, argv[0]);
+				return EXIT_SUCCESS;
+			default:
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind + 1 != argc) {
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	FILE *f = fopen(argv[optind], "rb");
+	if (f == NULL) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+	struct trace_header header;
+	if (fread(&header, sizeof header, 1, f) != 1 ||
+			memcmp(header.magic, TRACE_MAGIC, sizeof header.magic) != 0 ||
+			header.version != TRACE_VERSION ||
+			header.event_size != sizeof(struct trace_event) ||
+			header.count > TRACE_EVENTS) {
+		fprintf(stderr, "%s: not a wlsunset trace\n", argv[optind]);
+		fclose(f);
+		return EXIT_FAILURE;
+	}
+	struct trace_event *events = calloc(header.count + 1, sizeof(struct trace_event));
+	if (events == NULL || fread(events, sizeof(struct trace_event), header.count, f) != header.count) {
+		fprintf(stderr, "%s: truncated trace\n", argv[optind]);
+		free(events);
+		fclose(f);
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+
+	if (json) {
+		print_chrome(&header, events);
+	} else {
+		print_text(&header, events);
+	}
+	free(events);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,37 @@
+#include "color.h"
+#include "whitepoint_table.h"
+
+static struct rgb entry(const float e[3]) {
+	return (struct rgb) {.r = e[0], .g = e[1], .b = e[2]};
+}
+
+struct rgb lookup_whitepoint(int temp) {
+	if (temp == 6500) {
+		return (struct rgb) {.r = 1.0, .g = 1.0, .b = 1.0};
+	}
+
+	// calc_whitepoint() clamps to the same range
+	if (temp < WHITEPOINT_FINE_MIN) {
+		temp = WHITEPOINT_FINE_MIN;
+	} else if (temp > WHITEPOINT_MAX) {
+		temp = WHITEPOINT_MAX;
+	}
+
+	if (temp < WHITEPOINT_COARSE_MIN) {
+		return entry(whitepoint_fine[temp - WHITEPOINT_FINE_MIN]);
+	}
+
+	int idx = (temp - WHITEPOINT_COARSE_MIN) / WHITEPOINT_COARSE_STEP;
+	int rem = (temp - WHITEPOINT_COARSE_MIN) % WHITEPOINT_COARSE_STEP;
+	const float *a = whitepoint_coarse[idx];
+	if (rem == 0) {
+		return entry(a);
+	}
+	const float *b = whitepoint_coarse[idx + 1];
+	double factor = (double)rem / WHITEPOINT_COARSE_STEP;
+	return (struct rgb) {
+		.r = a[0] + (b[0] - a[0]) * factor,
+		.g = a[1] + (b[1] - a[1]) * factor,
+		.b = a[2] + (b[2] - a[2]) * factor,
+	};
+}